@@ -0,0 +1,286 @@
+#ifndef BUFFERPOOL_H__
+#define BUFFERPOOL_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+/*Receive buffers shared by many connections. Blocks come in power-of-two size classes; a released block goes
+onto its class's free list and the next request of that class takes it back (a hit) instead of allocating
+(a miss). Blocks nobody asked for within `idle_ttl` are freed, as is everything beyond `max_pooled_bytes`,
+so a burst of big messages doesn't pin memory for good. `global_limit` caps what all connections together
+may have lent out; a request over it throws std::length_error, which a websocket read reports as
+buffer_overflow. Thread-safe.*/
+class BufferPool
+{
+public:
+
+    struct Options
+    {
+        size_t min_block = 4096;                    //the smallest class, a power of two
+        size_t max_pooled_block = 1 << 22;          //larger blocks are allocated and freed directly
+        size_t max_pooled_bytes = 64 << 20;         //idle blocks kept for reuse, over all classes
+        size_t connection_limit = 1 << 26;          //the largest message one connection may buffer
+        size_t global_limit = 0;                    //bytes lent out over all connections; 0 - unlimited
+        size_t retain_bytes = 32768;                //a connection keeps a buffer up to this size between messages
+        std::chrono::milliseconds idle_ttl{ 30000 };
+    };
+
+    struct Counters
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t oversize = 0;                      //requests above max_pooled_block
+        uint64_t rejected = 0;                      //requests refused by global_limit
+        uint64_t trimmed = 0;                       //idle blocks freed
+        size_t in_use = 0;                          //bytes lent out now
+        size_t in_use_high_water = 0;
+        size_t pooled = 0;                          //bytes kept on the free lists now
+        size_t pooled_high_water = 0;
+    };
+
+protected:
+
+    using clock = std::chrono::steady_clock;
+
+    struct Block
+    {
+        void* data;
+        clock::time_point released;
+    };
+
+    Options _opt;
+    std::mutex _mutex;
+    std::vector<std::vector<Block>> _free;          //per class, oldest first
+    clock::time_point _last_trim;
+    Counters _counters;
+
+public:
+
+    BufferPool() : BufferPool(Options())
+    {
+    }
+
+    explicit BufferPool(Options opt) : _opt(opt), _last_trim(clock::now())
+    {
+        size_t classes = 1;
+        for (size_t size = _opt.min_block; size < _opt.max_pooled_block; size <<= 1)
+        {
+            ++classes;
+        }
+        _free.resize(classes);
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    const Options& GetOptions() const
+    {
+        return _opt;
+    }
+
+    /*A block of at least `size` bytes; hand it back with Release and the same `size`.*/
+    void* Acquire(size_t size)
+    {
+        size_t cls = Class(size);
+        size_t bytes = cls < _free.size() ? ClassSize(cls) : size;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_opt.global_limit && _counters.in_use + bytes > _opt.global_limit)
+        {
+            ++_counters.rejected;
+            throw std::length_error("BufferPool: global memory limit reached");
+        }
+        void* data = nullptr;
+        if (cls < _free.size() && !_free[cls].empty())
+        {
+            data = _free[cls].back().data;
+            _free[cls].pop_back();
+            _counters.pooled -= bytes;
+            ++_counters.hits;
+        }
+        else
+        {
+            data = ::operator new(bytes);
+            ++(cls < _free.size() ? _counters.misses : _counters.oversize);
+        }
+        _counters.in_use += bytes;
+        _counters.in_use_high_water = (std::max)(_counters.in_use_high_water, _counters.in_use);
+        return data;
+    }
+
+    void Release(void* data, size_t size)
+    {
+        if (!data)
+        {
+            return;
+        }
+        size_t cls = Class(size);
+        size_t bytes = cls < _free.size() ? ClassSize(cls) : size;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _counters.in_use -= bytes;
+        auto now = clock::now();
+        if (cls >= _free.size() || _counters.pooled + bytes > _opt.max_pooled_bytes)
+        {
+            ::operator delete(data);
+        }
+        else
+        {
+            _free[cls].push_back(Block{ data, now });
+            _counters.pooled += bytes;
+            _counters.pooled_high_water = (std::max)(_counters.pooled_high_water, _counters.pooled);
+        }
+        if (now - _last_trim >= _opt.idle_ttl / 4)
+        {
+            TrimLocked(now);
+        }
+    }
+
+    /*Frees the blocks idle for longer than idle_ttl; Release does it too, every quarter of the ttl.*/
+    void Trim()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        TrimLocked(clock::now());
+    }
+
+    /*Frees every idle block.*/
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& list : _free)
+        {
+            for (auto& block : list)
+            {
+                ::operator delete(block.data);
+            }
+            _counters.trimmed += list.size();
+            list.clear();
+        }
+        _counters.pooled = 0;
+    }
+
+    Counters GetCounters()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _counters;
+    }
+
+    virtual ~BufferPool()
+    {
+        Clear();
+    }
+
+protected:
+
+    /*Index of the smallest class holding `size`; _free.size() if no class does.*/
+    size_t Class(size_t size) const
+    {
+        size_t cls = 0;
+        for (size_t block = _opt.min_block; block < size; block <<= 1)
+        {
+            if (++cls == _free.size())
+            {
+                break;
+            }
+        }
+        return cls;
+    }
+
+    size_t ClassSize(size_t cls) const
+    {
+        return _opt.min_block << cls;
+    }
+
+    void TrimLocked(clock::time_point now)
+    {
+        _last_trim = now;
+        for (size_t cls = 0; cls < _free.size(); ++cls)
+        {
+            auto& list = _free[cls];
+            size_t expired = 0;
+            while (expired < list.size() && now - list[expired].released >= _opt.idle_ttl)
+            {
+                ::operator delete(list[expired].data);
+                ++expired;
+            }
+            if (expired)
+            {
+                list.erase(list.begin(), list.begin() + expired);
+                _counters.pooled -= expired * ClassSize(cls);
+                _counters.trimmed += expired;
+            }
+        }
+    }
+};
+
+
+/*Allocator drawing from a BufferPool, for containers such as beast::basic_flat_buffer.
+Without a pool it is plain operator new.*/
+template<typename T>
+class PoolAllocator
+{
+    template<typename U>
+    friend class PoolAllocator;
+
+protected:
+
+    std::shared_ptr<BufferPool> _pool;
+
+public:
+
+    using value_type = T;
+    //a buffer given a new pool takes the pool along
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    PoolAllocator() noexcept {}
+
+    explicit PoolAllocator(std::shared_ptr<BufferPool> pool) noexcept : _pool(std::move(pool)) {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : _pool(other._pool) {}
+
+    T* allocate(size_t n)
+    {
+        if (_pool)
+        {
+            return static_cast<T*>(_pool->Acquire(n * sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (_pool)
+        {
+            _pool->Release(p, n * sizeof(T));
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    const std::shared_ptr<BufferPool>& Pool() const
+    {
+        return _pool;
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>& other) const noexcept
+    {
+        return _pool == other._pool;
+    }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>& other) const noexcept
+    {
+        return _pool != other._pool;
+    }
+};
+
+#endif //BUFFERPOOL_H__
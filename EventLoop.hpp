@@ -0,0 +1,103 @@
+#ifndef EVENTLOOP_H__
+#define EVENTLOOP_H__
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace net = boost::asio;
+
+/*Owns an io_context that keeps running on its own thread(s) until Stop() is called.
+Sockets created on it (see WebSocketFactory) never restart/stop the context themselves,
+so one loop can drive many sockets with many operations in flight.*/
+class EventLoop
+{
+protected:
+    net::io_context _ioc;
+    std::unique_ptr<net::executor_work_guard<net::io_context::executor_type>> _work;
+    std::vector<std::thread> _threads;
+    size_t _thread_count;
+
+public:
+
+    explicit EventLoop(size_t threads = 1) : _ioc(static_cast<int>(threads ? threads : 1)), _thread_count(threads ? threads : 1)
+    {
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    net::io_context& Context()
+    {
+        return _ioc;
+    }
+
+    bool IsRunning() const
+    {
+        return !_threads.empty();
+    }
+
+    void Start()
+    {
+        if (IsRunning())
+        {
+            return;
+        }
+        _ioc.restart();
+        _work = std::make_unique<net::executor_work_guard<net::io_context::executor_type>>(_ioc.get_executor());
+        for (size_t i = 0; i < _thread_count; ++i)
+        {
+            _threads.emplace_back([this]() { _ioc.run(); });
+        }
+    }
+
+    /*Restricts the loop's threads to one CPU. Call after Start().*/
+    bool PinTo(size_t cpu)
+    {
+        bool ok = !_threads.empty();
+        for (auto& th : _threads)
+        {
+#ifdef _WIN32
+            ok = SetThreadAffinityMask(th.native_handle(), DWORD_PTR(1) << cpu) != 0 && ok;
+#else
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            ok = pthread_setaffinity_np(th.native_handle(), sizeof(set), &set) == 0 && ok;
+#endif
+        }
+        return ok;
+    }
+
+    /*Stops the context and joins the threads. Safe to call more than once.*/
+    void Stop()
+    {
+        _work.reset();
+        _ioc.stop();
+        for (auto& th : _threads)
+        {
+            if (th.joinable())
+            {
+                th.join();
+            }
+        }
+        _threads.clear();
+    }
+
+    virtual ~EventLoop()
+    {
+        Stop();
+    }
+};
+
+#endif //EVENTLOOP_H__
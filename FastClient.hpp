@@ -0,0 +1,313 @@
+#ifndef FASTCLIENT_H__
+#define FASTCLIENT_H__
+
+#include "WebSocket.hpp"
+#include "MessageCodec.hpp"
+
+/*Websocket client fixed at compile time for latency-critical paths: the transport, the logger and the codec are
+policies, so nothing is dispatched virtually, handlers are templates instead of std::function, and operations
+hold `this` instead of a shared_ptr.
+
+    FastClient<PlainTransport> client(ioc);
+    FastClient<TlsTransport, LoggerLog, BinaryCodec<Quote>> quotes(ioc, TlsTransport(WebSocketFactory::GetTlsContext()),
+        LoggerLog(logger));
+
+What it leaves out for that: there is no write queue (one write and one read may be outstanding, like a bare
+Beast stream), no heartbeat, deadlines or reconnect supervision, and it is not thread-safe - call it from its
+executor, where its handlers run. It must outlive its operations. The transports and the connect sequence are the
+ones the ISocket implementation uses (see ConnectChain). For anything else - transport picked from the
+URI at runtime, queued writes from any thread, read loops - use the type-erased ISocket from WebSocketFactory.*/
+
+/*Logging policy for the LOG_* macros that compiles every call away.*/
+struct SilentLog
+{
+    constexpr bool IsEnabled(LogLevel) const
+    {
+        return false;
+    }
+
+    void Log(LogLevel, const std::string&, const std::string&, bool) const
+    {
+    }
+};
+
+/*Logging policy forwarding to an ILogger.*/
+class LoggerLog
+{
+protected:
+
+    std::shared_ptr<ILogger> _logger;
+
+public:
+
+    explicit LoggerLog(std::shared_ptr<ILogger> logger) : _logger(std::move(logger))
+    {
+    }
+
+    bool IsEnabled(LogLevel level) const
+    {
+        return _logger->IsEnabled(level);
+    }
+
+    void Log(LogLevel level, const std::string& sender, const std::string& message, bool alsoLogToConsole) const
+    {
+        _logger->Log(level, sender, message, alsoLogToConsole);
+    }
+};
+
+/*Text frames written straight from the caller's buffer and read as views into the receive buffer.*/
+struct TextCodec
+{
+    static constexpr bool Binary = false;
+    using Message = std::string_view;
+    using Decoded = std::string_view;
+
+    static net::const_buffer Encode(std::string_view msg, std::string&)
+    {
+        return net::buffer(msg.data(), msg.size());
+    }
+
+    static bool Decode(std::string_view data, std::string_view& msg)
+    {
+        msg = data;
+        return true;
+    }
+};
+
+/*Binary frames carrying one MessageCodec message type.*/
+template<typename M>
+struct BinaryCodec
+{
+    static constexpr bool Binary = true;
+    using Message = M;
+    using Decoded = M;
+
+    static net::const_buffer Encode(const M& msg, std::string& scratch)
+    {
+        scratch.clear();
+        MessageCodec::Encode(msg, scratch);
+        return net::buffer(scratch);
+    }
+
+    static bool Decode(std::string_view data, M& msg)
+    {
+        return MessageCodec::Decode(data, msg);
+    }
+};
+
+
+template<typename Transport, typename Log = SilentLog, typename Codec = TextCodec>
+class FastClient final
+{
+public:
+
+    using Message = typename Codec::Message;
+    using Decoded = typename Codec::Decoded;
+    using Stream = typename ConnectChain<Transport>::Stream;
+
+protected:
+
+    HandlerArena _arena;        //first: outlives the stream whose operations it backs
+    ClientStrand _strand;
+    Log _log;
+    std::unique_ptr<Stream> _ws;
+    SocketCounters _stats;
+    ConnectChain<Transport> _chain;
+    std::shared_ptr<ResolverCache> _resolver_cache;
+    std::function<void(boost::system::error_code)> _connect_handler;    //connects aren't the hot path
+    std::string _host, _port, _path;
+    std::chrono::milliseconds _connect_timeout{ 60000 };
+    size_t _message_max = 1ull << 26;
+    beast::flat_buffer _buffers[2];     //alternated, so a handler can start the next read while it still holds views
+    unsigned _active = 0;
+    std::string _scratch;
+    bool _writing = false;
+    bool _reading = false;
+
+public:
+
+    explicit FastClient(net::io_context& ioc, Transport transport = Transport(), Log log = Log())
+        : _strand(net::make_strand(ioc)), _log(std::move(log)), _chain(_ws, _stats, _strand, std::move(transport))
+    {
+    }
+
+    FastClient(const FastClient&) = delete;
+    FastClient& operator=(const FastClient&) = delete;
+
+    const ClientStrand& GetExecutor() const
+    {
+        return _strand;
+    }
+
+    void SetResolverCache(std::shared_ptr<ResolverCache> cache)
+    {
+        _resolver_cache = std::move(cache);
+    }
+
+    void SetConnectTimeout(std::chrono::milliseconds timeout)
+    {
+        _connect_timeout = timeout;
+    }
+
+    void SetMessageMax(size_t bytes)
+    {
+        _message_max = bytes;
+    }
+
+    bool IsOpen() const
+    {
+        return _ws && _ws->is_open();
+    }
+
+    SocketStats Stats() const
+    {
+        return _stats.Snapshot();
+    }
+
+    Stream& Native()
+    {
+        return *_ws;
+    }
+
+    /** `handler(error_code)`; closes the previous connection's stream without a close handshake.
+    */
+    template<typename Handler>
+    void AsyncConnect(const std::string& uri, const std::string& port, Handler&& handler)
+    {
+        std::string prefix, uri_port;
+        std::tie(prefix, _host, uri_port, _path) = ISocket::ParseURI(uri);
+        _port = port.empty() ? uri_port : port;
+        _connect_handler = std::forward<Handler>(handler);
+        auto timeouts = websocket::stream_base::timeout::suggested(beast::role_type::client);
+        timeouts.handshake_timeout = _connect_timeout;
+        _chain.Start(_resolver_cache, _host, _port, _path, std::chrono::steady_clock::now() + _connect_timeout, timeouts,
+            [this](Stream& stream)
+            {
+                stream.binary(Codec::Binary);
+                stream.read_message_max(_message_max);
+            },
+            [this](boost::system::error_code ec, ConnectPhase phase) { OnConnected(ec, phase); });
+    }
+
+    /** `handler(error_code)`. With TextCodec the frame is sent from `msg` itself, so it must stay valid until then.
+    */
+    template<typename Handler>
+    void AsyncWrite(const Message& msg, Handler&& handler)
+    {
+        if (auto ec = Refused(_writing))
+        {
+            net::post(_strand, [handler = std::forward<Handler>(handler), ec]() mutable { handler(ec); });
+            return;
+        }
+        _writing = true;
+        _ws->async_write(Codec::Encode(msg, _scratch), MakeArenaHandler(_arena,
+            [this, handler = std::forward<Handler>(handler)](boost::system::error_code ec, std::size_t bytes) mutable
+            {
+                _writing = false;
+                if (ec)
+                {
+                    Failed(ec, "FastClient.Write");
+                }
+                else
+                {
+                    _stats.Sent(bytes);
+                }
+                handler(ec);
+            }));
+    }
+
+    /** `handler(error_code, const Decoded&)`; the message (views into it, with TextCodec) is only valid during the
+    call. A frame the codec can't decode completes with `bad_message`.
+    */
+    template<typename Handler>
+    void AsyncRead(Handler&& handler)
+    {
+        if (auto ec = Refused(_reading))
+        {
+            net::post(_strand, [handler = std::forward<Handler>(handler), ec]() mutable { handler(ec, Decoded()); });
+            return;
+        }
+        _reading = true;
+        auto& buffer = _buffers[_active];
+        _ws->async_read(buffer, MakeArenaHandler(_arena,
+            [this, &buffer, handler = std::forward<Handler>(handler)](boost::system::error_code ec, std::size_t bytes) mutable
+            {
+                _reading = false;
+                _active ^= 1;
+                Decoded msg{};
+                if (ec)
+                {
+                    Failed(ec, "FastClient.Read");
+                }
+                else
+                {
+                    _stats.Received(bytes);
+                    auto data = buffer.data();
+                    if (!Codec::Decode(std::string_view(static_cast<const char*>(data.data()), data.size()), msg))
+                    {
+                        ec = boost::system::errc::make_error_code(boost::system::errc::bad_message);
+                        Failed(ec, "FastClient.Read");
+                    }
+                }
+                handler(ec, static_cast<const Decoded&>(msg));
+                buffer.consume(buffer.size());
+            }));
+    }
+
+    /** `handler(error_code)`.
+    */
+    template<typename Handler>
+    void AsyncClose(Handler&& handler)
+    {
+        if (!_ws)
+        {
+            net::post(_strand, [handler = std::forward<Handler>(handler)]() mutable { handler(boost::system::error_code()); });
+            return;
+        }
+        _ws->async_close(websocket::close_code::normal, [this, handler = std::forward<Handler>(handler)](boost::system::error_code ec) mutable
+            {
+                if (ec)
+                {
+                    Failed(ec, "FastClient.Close");
+                }
+                handler(ec);
+            });
+    }
+
+protected:
+
+    /*Why a read or write can't start now, if it can't.*/
+    boost::system::error_code Refused(bool busy) const
+    {
+        if (!IsOpen())
+        {
+            return net::error::not_connected;
+        }
+        if (busy)
+        {
+            return net::error::already_started;
+        }
+        return {};
+    }
+
+    void Failed(boost::system::error_code ec, const char* sender)
+    {
+        _stats.Error(ec);
+        LOG_ERROR(&_log, sender, "Error on {}:{}{}: {}", _host, _port, _path, ec.message());
+    }
+
+    void OnConnected(boost::system::error_code ec, ConnectPhase phase)
+    {
+        if (ec)
+        {
+            _stats.Error(ec);
+            LOG_ERROR(&_log, "FastClient.Connect", "Error on {}:{}{} in {}: {}", _host, _port, _path, ConnectPhaseName(phase), ec.message());
+        }
+        _stats.ConnectDone(ec);
+        auto handler = std::move(_connect_handler);
+        _connect_handler = nullptr;
+        handler(ec);
+    }
+};
+
+#endif //FASTCLIENT_H__
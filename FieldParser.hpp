@@ -0,0 +1,278 @@
+#ifndef FIELDPARSER_H__
+#define FIELDPARSER_H__
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define FIELDPARSER_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define FIELDPARSER_TARGET_SSE2
+#define FIELDPARSER_TARGET_AVX2
+#else
+#define FIELDPARSER_TARGET_SSE2 __attribute__((target("sse2")))
+#define FIELDPARSER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/*Splits delimited text payloads ("42|EURUSD,1.08412,1.08419") into fields without allocating.
+Delimiters are found 64 bytes at a time with AVX2 or SSE2 where the CPU has them (picked at runtime),
+otherwise with a scalar loop. Fields are string_views into the scanned text.*/
+
+/** Parses the whole of `text` as an integer or floating-point number with std::from_chars
+(no locale, no leading '+' or whitespace). False if anything is left over or the value doesn't fit.
+*/
+template<typename T>
+inline bool ParseNumber(std::string_view text, T& value)
+{
+    auto end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+struct Field
+{
+    std::string_view text;
+    char delimiter = '\0';      //the delimiter that ended the field, '\0' for the last one
+
+    template<typename T>
+    bool To(T& value) const
+    {
+        return ParseNumber(text, value);
+    }
+};
+
+using FieldList = std::vector<Field>;
+
+enum class SimdLevel
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+inline const char* SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Sse2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+/** The best level this CPU (and OS) supports; detected once.
+*/
+inline SimdLevel DetectSimd()
+{
+    static const SimdLevel level = []()
+        {
+#if defined(FIELDPARSER_X86) && defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            int max_leaf = info[0];
+            __cpuid(info, 1);
+            bool sse2 = (info[3] & (1 << 26)) != 0;
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx2 = false;
+            if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6)
+            {
+                __cpuidex(info, 7, 0);
+                avx2 = (info[1] & (1 << 5)) != 0;
+            }
+            return avx2 ? SimdLevel::Avx2 : sse2 ? SimdLevel::Sse2 : SimdLevel::Scalar;
+#elif defined(FIELDPARSER_X86)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? SimdLevel::Avx2 : __builtin_cpu_supports("sse2") ? SimdLevel::Sse2 : SimdLevel::Scalar;
+#else
+            return SimdLevel::Scalar;
+#endif
+        }();
+    return level;
+}
+
+
+class FieldSplitter
+{
+public:
+
+    static constexpr size_t MaxDelimiters = 4;
+
+protected:
+
+    struct Delimiters
+    {
+        char chars[MaxDelimiters] = {};     //unused slots repeat the first delimiter
+        bool table[256] = {};
+    };
+
+    using Kernel = uint64_t(*)(const char* block, const Delimiters& delimiters);
+
+    Delimiters _delimiters;
+    Kernel _kernel;
+    SimdLevel _level;
+
+public:
+
+    /** Up to MaxDelimiters delimiter characters (more are ignored); `level` is capped at what the CPU supports.
+    */
+    explicit FieldSplitter(std::string_view delimiters = "|,", SimdLevel level = SimdLevel::Avx2)
+    {
+        size_t count = (std::min)(delimiters.size(), MaxDelimiters);
+        for (size_t i = 0; i < MaxDelimiters; ++i)
+        {
+            _delimiters.chars[i] = count ? delimiters[i < count ? i : 0] : '\0';
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            _delimiters.table[static_cast<unsigned char>(delimiters[i])] = true;
+        }
+        //with no delimiters the SIMD kernels would match '\0'
+        _level = count ? (std::min)(level, DetectSimd()) : SimdLevel::Scalar;
+        switch (_level)
+        {
+#ifdef FIELDPARSER_X86
+        case SimdLevel::Avx2: _kernel = &MaskAvx2; break;
+        case SimdLevel::Sse2: _kernel = &MaskSse2; break;
+#endif
+        default: _kernel = &MaskScalar; _level = SimdLevel::Scalar; break;
+        }
+    }
+
+    SimdLevel Level() const
+    {
+        return _level;
+    }
+
+    /** Calls `f(const Field&)` for every field of `text` in order; empty text is one empty field.
+    */
+    template<typename F>
+    void ForEach(std::string_view text, F&& f) const
+    {
+        const char* data = text.data();
+        size_t size = text.size();
+        size_t start = 0;
+        for (size_t base = 0; base < size; base += 64)
+        {
+            uint64_t mask;
+            if (size - base >= 64)
+            {
+                mask = _kernel(data + base, _delimiters);
+            }
+            else
+            {
+                //the kernels always read 64 bytes, so the tail is scanned from a padded copy
+                char tail[64] = {};
+                std::memcpy(tail, data + base, size - base);
+                mask = _kernel(tail, _delimiters) & ((uint64_t(1) << (size - base)) - 1);
+            }
+            while (mask)
+            {
+                size_t pos = base + LowestBit(mask);
+                f(Field{ text.substr(start, pos - start), data[pos] });
+                start = pos + 1;
+                mask &= mask - 1;
+            }
+        }
+        f(Field{ text.substr(start), '\0' });
+    }
+
+    /** Replaces the contents of `fields`; reusing one list keeps this allocation-free once it has grown.
+    */
+    void Split(std::string_view text, FieldList& fields) const
+    {
+        fields.clear();
+        ForEach(text, [&fields](const Field& field) { fields.push_back(field); });
+    }
+
+    /** Writes at most `capacity` fields and returns how many the text has (which may be more).
+    */
+    size_t Split(std::string_view text, Field* fields, size_t capacity) const
+    {
+        size_t count = 0;
+        ForEach(text, [&](const Field& field)
+            {
+                if (count < capacity)
+                {
+                    fields[count] = field;
+                }
+                ++count;
+            });
+        return count;
+    }
+
+protected:
+
+    static size_t LowestBit(uint64_t mask)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+#if defined(_M_X64)
+        _BitScanForward64(&index, mask);
+#else
+        if (!_BitScanForward(&index, static_cast<unsigned long>(mask)))
+        {
+            _BitScanForward(&index, static_cast<unsigned long>(mask >> 32));
+            index += 32;
+        }
+#endif
+        return index;
+#else
+        return static_cast<size_t>(__builtin_ctzll(mask));
+#endif
+    }
+
+    static uint64_t MaskScalar(const char* block, const Delimiters& delimiters)
+    {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < 64; ++i)
+        {
+            mask |= static_cast<uint64_t>(delimiters.table[static_cast<unsigned char>(block[i])]) << i;
+        }
+        return mask;
+    }
+
+#ifdef FIELDPARSER_X86
+    FIELDPARSER_TARGET_SSE2 static uint64_t MaskSse2(const char* block, const Delimiters& delimiters)
+    {
+        const __m128i d0 = _mm_set1_epi8(delimiters.chars[0]), d1 = _mm_set1_epi8(delimiters.chars[1]);
+        const __m128i d2 = _mm_set1_epi8(delimiters.chars[2]), d3 = _mm_set1_epi8(delimiters.chars[3]);
+        uint64_t mask = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, d0), _mm_cmpeq_epi8(bytes, d1)),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, d2), _mm_cmpeq_epi8(bytes, d3)));
+            mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(hits))) << (16 * i);
+        }
+        return mask;
+    }
+
+    FIELDPARSER_TARGET_AVX2 static uint64_t MaskAvx2(const char* block, const Delimiters& delimiters)
+    {
+        const __m256i d0 = _mm256_set1_epi8(delimiters.chars[0]), d1 = _mm256_set1_epi8(delimiters.chars[1]);
+        const __m256i d2 = _mm256_set1_epi8(delimiters.chars[2]), d3 = _mm256_set1_epi8(delimiters.chars[3]);
+        uint64_t mask = 0;
+        for (int i = 0; i < 2; ++i)
+        {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+            __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, d0), _mm256_cmpeq_epi8(bytes, d1)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(bytes, d2), _mm256_cmpeq_epi8(bytes, d3)));
+            mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hits))) << (32 * i);
+        }
+        return mask;
+    }
+#endif
+};
+
+#endif //FIELDPARSER_H__
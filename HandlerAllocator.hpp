@@ -0,0 +1,216 @@
+#ifndef HANDLERALLOCATOR_H__
+#define HANDLERALLOCATOR_H__
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/handler_continuation_hook.hpp>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*Recycled memory for the operation state Asio and Beast allocate per async operation. A connection keeps
+a few slots; each grows to the largest operation it has held and is then reused, so a steady read/write loop
+allocates nothing. Slots are claimed and returned with atomics (an op may be freed on a different thread
+than the one that started it); when all are busy the arena falls back to operator new.
+Handlers using it must keep its owner alive, which the socket's handlers do by holding the socket.*/
+class HandlerArena
+{
+protected:
+
+    struct Slot
+    {
+        std::atomic<bool> busy{ false };
+        std::atomic<void*> data{ nullptr };
+        size_t size = 0;                    //touched only by the slot's current holder
+    };
+
+    static constexpr size_t SlotCount = 8;
+    Slot _slots[SlotCount];
+    std::atomic<uint64_t> _fallbacks{ 0 };
+
+public:
+
+    HandlerArena() {}
+
+    HandlerArena(const HandlerArena&) = delete;
+    HandlerArena& operator=(const HandlerArena&) = delete;
+
+    void* Allocate(size_t size)
+    {
+        //a free slot that is big enough, else a free one to grow
+        Slot* grow = nullptr;
+        for (auto& slot : _slots)
+        {
+            if (slot.busy.load(std::memory_order_relaxed) || slot.busy.exchange(true, std::memory_order_acquire))
+            {
+                continue;
+            }
+            if (slot.size >= size)
+            {
+                if (grow)
+                {
+                    grow->busy.store(false, std::memory_order_release);
+                }
+                return slot.data.load(std::memory_order_relaxed);
+            }
+            if (grow)
+            {
+                slot.busy.store(false, std::memory_order_release);
+                continue;
+            }
+            grow = &slot;
+        }
+        if (!grow)
+        {
+            _fallbacks.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+        ::operator delete(grow->data.load(std::memory_order_relaxed));
+        grow->data.store(nullptr, std::memory_order_relaxed);
+        grow->size = 0;
+        void* data = ::operator new(size);
+        grow->data.store(data, std::memory_order_relaxed);
+        grow->size = size;
+        return data;
+    }
+
+    void Deallocate(void* p)
+    {
+        for (auto& slot : _slots)
+        {
+            if (slot.data.load(std::memory_order_relaxed) == p && slot.busy.load(std::memory_order_relaxed))
+            {
+                slot.busy.store(false, std::memory_order_release);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+    /*Allocations that found every slot busy.*/
+    uint64_t Fallbacks() const
+    {
+        return _fallbacks.load(std::memory_order_relaxed);
+    }
+
+    virtual ~HandlerArena()
+    {
+        for (auto& slot : _slots)
+        {
+            ::operator delete(slot.data.load());
+        }
+    }
+};
+
+
+template<typename T>
+class HandlerAllocator
+{
+    template<typename U>
+    friend class HandlerAllocator;
+
+protected:
+
+    HandlerArena* _arena;
+
+public:
+
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerArena& arena) noexcept : _arena(&arena) {}
+
+    template<typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : _arena(other._arena) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(_arena->Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        _arena->Deallocate(p);
+    }
+
+    template<typename U>
+    bool operator==(const HandlerAllocator<U>& other) const noexcept
+    {
+        return _arena == other._arena;
+    }
+
+    template<typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const noexcept
+    {
+        return _arena != other._arena;
+    }
+};
+
+
+/*Completion handler wrapper that makes the operations it is passed to allocate from an arena.
+The wrapped handler's executor (see the associated_executor specialization below) and continuation hint are kept.*/
+template<typename Handler>
+class ArenaHandler
+{
+protected:
+
+    HandlerArena* _arena;
+    Handler _handler;
+
+public:
+
+    using allocator_type = HandlerAllocator<void>;
+
+    template<typename H>
+    ArenaHandler(HandlerArena& arena, H&& handler) : _arena(&arena), _handler(std::forward<H>(handler)) {}
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(*_arena);
+    }
+
+    const Handler& Inner() const noexcept
+    {
+        return _handler;
+    }
+
+    template<typename... Args>
+    void operator()(Args&&... args)
+    {
+        _handler(std::forward<Args>(args)...);
+    }
+
+    friend bool asio_handler_is_continuation(ArenaHandler* self)
+    {
+        return boost::asio::asio_handler_is_continuation(std::addressof(self->_handler));
+    }
+};
+
+/*A handler without an executor of its own must keep running on the operation's executor (the socket's
+strand), so the wrapper can't just report get_associated_executor(handler): that would be the system executor.*/
+namespace boost
+{
+namespace asio
+{
+//deriving keeps Asio's "unspecialised" marker, so dispatching a wrapped plain handler needs no work_dispatcher
+template<typename Handler, typename Executor>
+struct associated_executor<ArenaHandler<Handler>, Executor> : associated_executor<Handler, Executor>
+{
+    using type = associated_executor_t<Handler, Executor>;
+
+    static type get(const ArenaHandler<Handler>& handler, const Executor& ex = Executor()) noexcept
+    {
+        return get_associated_executor(handler.Inner(), ex);
+    }
+};
+}
+}
+
+template<typename Handler>
+ArenaHandler<typename std::decay<Handler>::type> MakeArenaHandler(HandlerArena& arena, Handler&& handler)
+{
+    return ArenaHandler<typename std::decay<Handler>::type>(arena, std::forward<Handler>(handler));
+}
+
+#endif //HANDLERALLOCATOR_H__
@@ -0,0 +1,204 @@
+#ifndef HISTOGRAM_H__
+#define HISTOGRAM_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*Log-linear histogram in the spirit of HdrHistogram: values below 128 are exact, above that every power of two
+is split into 64 buckets, i.e. about 1.5% worst-case relative error over the whole uint64_t range.
+Recording is a couple of shifts and an increment; not thread-safe, merge per-thread instances instead.*/
+class Histogram
+{
+protected:
+    static constexpr int SubBits = 6;
+    static constexpr uint64_t SubCount = 1ull << SubBits;
+    static constexpr size_t BucketCount = (64 - SubBits) * SubCount + 2 * SubCount;
+
+    std::vector<uint64_t> _counts;
+    uint64_t _total = 0;
+    uint64_t _min = std::numeric_limits<uint64_t>::max();
+    uint64_t _max = 0;
+    long double _sum = 0;
+
+    static int Msb(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    static size_t IndexOf(uint64_t value)
+    {
+        if (value < 2 * SubCount)
+        {
+            return static_cast<size_t>(value);
+        }
+        auto shift = Msb(value) - SubBits;
+        return static_cast<size_t>(shift) * SubCount + static_cast<size_t>(value >> shift);
+    }
+
+    /*Midpoint of the bucket's value range.*/
+    static uint64_t ValueOf(size_t index)
+    {
+        if (index < 2 * SubCount)
+        {
+            return index;
+        }
+        auto shift = static_cast<int>(index / SubCount) - 1;
+        auto mantissa = index - static_cast<size_t>(shift) * SubCount;
+        return (static_cast<uint64_t>(mantissa) << shift) + ((1ull << shift) >> 1);
+    }
+
+public:
+
+    Histogram() : _counts(BucketCount, 0)
+    {
+    }
+
+    void Record(uint64_t value)
+    {
+        ++_counts[IndexOf(value)];
+        ++_total;
+        _sum += value;
+        _min = (std::min)(_min, value);
+        _max = (std::max)(_max, value);
+    }
+
+    void Merge(const Histogram& other)
+    {
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            _counts[i] += other._counts[i];
+        }
+        _total += other._total;
+        _sum += other._sum;
+        _min = (std::min)(_min, other._min);
+        _max = (std::max)(_max, other._max);
+    }
+
+    void Reset()
+    {
+        std::fill(_counts.begin(), _counts.end(), 0);
+        _total = 0;
+        _sum = 0;
+        _min = std::numeric_limits<uint64_t>::max();
+        _max = 0;
+    }
+
+    uint64_t Count() const
+    {
+        return _total;
+    }
+
+    uint64_t Min() const
+    {
+        return _total ? _min : 0;
+    }
+
+    uint64_t Max() const
+    {
+        return _max;
+    }
+
+    double Mean() const
+    {
+        return _total ? static_cast<double>(_sum / _total) : 0.0;
+    }
+
+    /*`percentile` in [0, 100]. The result is clamped to the exact recorded min/max.*/
+    uint64_t Percentile(double percentile) const
+    {
+        if (_total == 0)
+        {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(_total) + 0.5);
+        rank = (std::max)(rank, static_cast<uint64_t>(1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            seen += _counts[i];
+            if (seen >= rank)
+            {
+                return (std::min)((std::max)(ValueOf(i), Min()), _max);
+            }
+        }
+        return _max;
+    }
+};
+
+
+/*Histogram over roughly the last `window` of samples: two halves, the older one is dropped when the current one
+is `window` old. A snapshot covers between one and two windows. Not thread-safe.*/
+class RollingHistogram
+{
+protected:
+    using clock = std::chrono::steady_clock;
+
+    Histogram _current, _previous;
+    clock::duration _window;
+    clock::time_point _rotated;
+
+    void Rotate(clock::time_point now)
+    {
+        if (now - _rotated < _window)
+        {
+            return;
+        }
+        if (now - _rotated < 2 * _window)
+        {
+            std::swap(_previous, _current);
+        }
+        else
+        {
+            _previous.Reset();
+        }
+        _current.Reset();
+        _rotated = now;
+    }
+
+public:
+
+    explicit RollingHistogram(clock::duration window = std::chrono::seconds(60)) : _window(window), _rotated(clock::now())
+    {
+    }
+
+    void Record(uint64_t value, clock::time_point now = clock::now())
+    {
+        Rotate(now);
+        _current.Record(value);
+    }
+
+    Histogram Snapshot(clock::time_point now = clock::now()) const
+    {
+        Histogram ret;
+        if (now - _rotated < 2 * _window)
+        {
+            ret.Merge(_current);
+        }
+        if (now - _rotated < _window)
+        {
+            ret.Merge(_previous);
+        }
+        return ret;
+    }
+
+    void Reset()
+    {
+        _current.Reset();
+        _previous.Reset();
+        _rotated = clock::now();
+    }
+};
+
+#endif //HISTOGRAM_H__
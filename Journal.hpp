@@ -0,0 +1,263 @@
+#ifndef JOURNAL_H__
+#define JOURNAL_H__
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace p_time = boost::posix_time;
+
+/*Append-only CSV journal of request/response records. Keeps the file open, collects records in a
+large in-memory buffer and writes it out according to the flush policy; rotates the file by size and/or age.
+Every record starts with the UTC time; fields are escaped per RFC 4180.*/
+class Journal
+{
+public:
+
+    struct Options
+    {
+        std::string path = "Client_requests_responses.csv";
+        std::string header = "#time,request,response";
+        size_t buffer_size = 1 << 20;                       //write out once this much is buffered
+        size_t flush_every = 0;                             //records; 0 - don't flush by count
+        std::chrono::milliseconds flush_interval{ 1000 };   //checked on append; 0 - don't flush by time
+        uint64_t max_file_bytes = 0;                        //0 - no size rotation
+        p_time::time_duration max_file_age = p_time::seconds(0);   //0 - no time rotation
+    };
+
+protected:
+
+    Options _opt;
+    std::ofstream _file;
+    std::string _buffer;
+    std::mutex _mutex;
+    uint64_t _file_bytes = 0;
+    uint64_t _header_bytes = 0;
+    size_t _unflushed = 0;
+    p_time::ptime _opened_at;
+    std::chrono::steady_clock::time_point _last_flush;
+    time_t _cached_second = 0;
+    std::string _cached_time;
+
+public:
+
+    Journal() : Journal(Options())
+    {
+    }
+
+    explicit Journal(Options opt) : _opt(std::move(opt))
+    {
+        _buffer.reserve(_opt.buffer_size + 4096);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    bool Open()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return OpenFile();
+    }
+
+    bool IsOpen() const
+    {
+        return _file.is_open();
+    }
+
+    /*Appends "time,field1,field2,...".*/
+    void Append(const std::vector<std::string>& fields)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        RotateIfFull();
+        AppendTime();
+        for (const auto& field : fields)
+        {
+            _buffer += ',';
+            AppendEscaped(field);
+        }
+        _buffer += '\n';
+        Committed();
+    }
+
+    void Append(std::string_view request, std::string_view response)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        RotateIfFull();
+        AppendTime();
+        _buffer += ',';
+        AppendEscaped(request);
+        _buffer += ',';
+        AppendEscaped(response);
+        _buffer += '\n';
+        Committed();
+    }
+
+    /*Appends "time,line" with `line` taken as already formatted CSV.*/
+    void AppendRaw(std::string_view line)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        RotateIfFull();
+        AppendTime();
+        _buffer += ',';
+        _buffer += line;
+        _buffer += '\n';
+        Committed();
+    }
+
+    void Flush()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        WriteOut(true);
+    }
+
+    virtual ~Journal()
+    {
+        Flush();
+        if (_file.is_open())
+        {
+            _file.close();
+        }
+    }
+
+    static bool NeedsQuoting(std::string_view field)
+    {
+        return field.find_first_of(",\"\r\n") != std::string_view::npos;
+    }
+
+protected:
+
+    void AppendEscaped(std::string_view field)
+    {
+        if (!NeedsQuoting(field))
+        {
+            _buffer += field;
+            return;
+        }
+        _buffer += '"';
+        for (;;)
+        {
+            auto quote = field.find('"');
+            if (quote == std::string_view::npos)
+            {
+                _buffer += field;
+                break;
+            }
+            _buffer += field.substr(0, quote + 1);
+            _buffer += '"';
+            field.remove_prefix(quote + 1);
+        }
+        _buffer += '"';
+    }
+
+    void AppendTime()
+    {
+        auto seconds = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        if (seconds != _cached_second || _cached_time.empty())
+        {
+            _cached_second = seconds;
+            _cached_time = p_time::to_simple_string(p_time::from_time_t(seconds));
+        }
+        _buffer += _cached_time;
+    }
+
+    /*Applies the flush policy after a record has been added to the buffer.*/
+    void Committed()
+    {
+        ++_unflushed;
+        auto now = std::chrono::steady_clock::now();
+        if (_buffer.size() >= _opt.buffer_size)
+        {
+            WriteOut(false);
+        }
+        if ((_opt.flush_every > 0 && _unflushed >= _opt.flush_every)
+            || (_opt.flush_interval.count() > 0 && now - _last_flush >= _opt.flush_interval))
+        {
+            WriteOut(true);
+        }
+    }
+
+    void WriteOut(bool flush)
+    {
+        if (!_file.is_open() && !OpenFile())
+        {
+            _buffer.clear();
+            return;
+        }
+        if (_opt.max_file_age.total_seconds() > 0 && p_time::second_clock::universal_time() - _opened_at >= _opt.max_file_age)
+        {
+            Rotate();
+        }
+        if (!_buffer.empty())
+        {
+            _file.write(_buffer.data(), _buffer.size());
+            _file_bytes += _buffer.size();
+            _buffer.clear();
+        }
+        if (flush)
+        {
+            _file.flush();
+            _unflushed = 0;
+            _last_flush = std::chrono::steady_clock::now();
+        }
+    }
+
+    /*Size rotation happens between records, so a file exceeds the limit by at most one record.*/
+    void RotateIfFull()
+    {
+        if (_opt.max_file_bytes == 0 || _file_bytes + _buffer.size() < _opt.max_file_bytes || _file_bytes + _buffer.size() <= _header_bytes)
+        {
+            return;
+        }
+        WriteOut(false);
+        Rotate();
+    }
+
+    /*The active file keeps its name; finished files get the rotation time inserted before the extension.*/
+    void Rotate()
+    {
+        _file.flush();
+        _file.close();
+        boost::filesystem::path active(_opt.path);
+        auto stamp = p_time::to_iso_string(p_time::second_clock::universal_time());
+        auto rotated = active.parent_path() / (active.stem().string() + "_" + stamp + active.extension().string());
+        boost::system::error_code ec;
+        for (int i = 1; boost::filesystem::exists(rotated, ec); ++i)
+        {
+            rotated = active.parent_path() / (active.stem().string() + "_" + stamp + "_" + std::to_string(i) + active.extension().string());
+        }
+        boost::filesystem::rename(active, rotated, ec);
+        OpenFile();
+    }
+
+    bool OpenFile()
+    {
+        if (_file.is_open())
+        {
+            return true;
+        }
+        boost::system::error_code ec;
+        auto existing = boost::filesystem::exists(_opt.path, ec) ? boost::filesystem::file_size(_opt.path, ec) : 0;
+        _file.open(_opt.path, std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+        if (!_file.is_open())
+        {
+            return false;
+        }
+        _file_bytes = ec ? 0 : existing;
+        _header_bytes = _opt.header.empty() ? 0 : _opt.header.size() + 1;
+        if (_file_bytes == 0 && _header_bytes > 0)
+        {
+            _file << _opt.header << '\n';
+            _file_bytes = _header_bytes;
+        }
+        _opened_at = p_time::second_clock::universal_time();
+        _last_flush = std::chrono::steady_clock::now();
+        return true;
+    }
+};
+
+#endif //JOURNAL_H__
@@ -0,0 +1,332 @@
+#ifndef ASYNCLOGGER_H__
+#define ASYNCLOGGER_H__
+#include "BasicLogger.hpp"
+#include <boost/date_time/c_local_time_adjustor.hpp>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*Bounded lock-free multi-producer/single-consumer ring (after D. Vyukov's bounded queue).
+Capacity is rounded up to a power of two.*/
+template<typename T> class MpscRing
+{
+protected:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueue{ 0 };
+    alignas(64) size_t _dequeue = 0;
+
+public:
+
+    explicit MpscRing(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        _cells.reset(new Cell[size]);
+        _mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t Capacity() const
+    {
+        return _mask + 1;
+    }
+
+    /*Any thread. Returns false when the ring is full.*/
+    bool TryPush(T&& value)
+    {
+        auto pos = _enqueue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& cell = _cells[pos & _mask];
+            auto seq = cell.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.data = std::move(value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = _enqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*Consumer thread only. A push still writing its cell doesn't count yet.*/
+    bool Empty() const
+    {
+        auto seq = _cells[_dequeue & _mask].seq.load(std::memory_order_acquire);
+        return static_cast<intptr_t>(seq) - static_cast<intptr_t>(_dequeue + 1) < 0;
+    }
+
+    /*Consumer thread only.*/
+    bool TryPop(T& value)
+    {
+        auto& cell = _cells[_dequeue & _mask];
+        auto seq = cell.seq.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(_dequeue + 1) < 0)
+        {
+            return false;
+        }
+        value = std::move(cell.data);
+        cell.seq.store(_dequeue + _mask + 1, std::memory_order_release);
+        ++_dequeue;
+        return true;
+    }
+};
+
+
+/*BasicLogger whose LogMessage/LogError only enqueue the record. A background thread formats the records,
+writes them in batches (one write and one flush per batch per file) and rotates files off the caller's thread.
+Safe to share between threads.*/
+class AsyncLogger : public BasicLogger
+{
+public:
+
+    enum class OverflowPolicy
+    {
+        Block,      //wait for room in the queue
+        Drop,       //silently discard the record
+        CountDrops  //discard the record, report the number of discarded records in the log
+    };
+
+protected:
+
+    struct Record
+    {
+        std::chrono::system_clock::time_point time;
+        std::string sender;
+        std::string message;
+        bool error = false;
+        bool console = false;
+    };
+
+    MpscRing<Record> _queue;
+    OverflowPolicy _policy;
+    std::atomic<uint64_t> _dropped{ 0 };
+    std::atomic<uint64_t> _pushed{ 0 };
+    std::atomic<uint64_t> _written{ 0 };
+    std::atomic<bool> _stop{ false };
+    std::atomic<size_t> _producers{ 0 };    //Push calls in progress, so shutdown can wait for their records
+    std::recursive_mutex _file_mutex;
+    std::thread _worker;
+
+    time_t _cached_second = 0;
+    std::string _cached_time;
+    std::string _msgBatch, _errBatch;
+
+public:
+
+    explicit AsyncLogger(size_t capacity = 1 << 16, OverflowPolicy policy = OverflowPolicy::Block) : _queue(capacity), _policy(policy)
+    {
+        _worker = std::thread([this]() { Run(); });
+    }
+
+    virtual bool AssignFiles(const std::string& filenameBase, const std::string& extension = ".log") override
+    {
+        std::lock_guard<std::recursive_mutex> lock(_file_mutex);
+        return BasicLogger::AssignFiles(filenameBase, extension);
+    }
+
+    virtual bool AssignFiles(const std::string& filenameBase, const p_time::ptime& time, const std::string& extension = ".log", const p_time::time_duration& recreation_period = p_time::hours(24)) override
+    {
+        std::lock_guard<std::recursive_mutex> lock(_file_mutex);
+        return BasicLogger::AssignFiles(filenameBase, time, extension, recreation_period);
+    }
+
+    virtual void ResetFileStreams() override
+    {
+        std::lock_guard<std::recursive_mutex> lock(_file_mutex);
+        BasicLogger::ResetFileStreams();
+    }
+
+    virtual void LogMessage(const std::string& sender, const std::string& message, bool alsoLogToConsole = false) override
+    {
+        Push(sender, message, false, alsoLogToConsole);
+    }
+
+    virtual void LogError(const std::string& sender, const std::string& message, bool alsoLogToConsole = true) override
+    {
+        Push(sender, message, true, alsoLogToConsole);
+    }
+
+    uint64_t Dropped() const
+    {
+        return _dropped;
+    }
+
+    /*Blocks until everything enqueued so far has been written.*/
+    void Flush()
+    {
+        auto target = _pushed.load();
+        while (_written.load() < target && !_stop)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    virtual ~AsyncLogger()
+    {
+        _stop = true;
+        if (_worker.joinable())
+        {
+            _worker.join();
+        }
+    }
+
+protected:
+
+    void Push(const std::string& sender, const std::string& message, bool error, bool console)
+    {
+        Record rec;
+        rec.time = std::chrono::system_clock::now();
+        rec.sender = sender;
+        rec.message = message;
+        rec.error = error;
+        rec.console = console;
+        ++_producers;
+        while (!_queue.TryPush(std::move(rec)))
+        {
+            if (_policy != OverflowPolicy::Block || _stop)
+            {
+                ++_dropped;
+                --_producers;
+                return;
+            }
+            std::this_thread::yield();
+        }
+        ++_pushed;
+        --_producers;
+    }
+
+    void Run()
+    {
+        Record rec;
+        uint64_t reported_drops = 0;
+        int idle = 0;
+        for (;;)
+        {
+            size_t count = 0;
+            while (count < 4096 && _queue.TryPop(rec))
+            {
+                Append(rec);
+                ++count;
+            }
+            if (_policy == OverflowPolicy::CountDrops && _dropped != reported_drops)
+            {
+                auto dropped = _dropped.load();
+                rec.time = std::chrono::system_clock::now();
+                rec.sender = "AsyncLogger";
+                rec.message = std::to_string(dropped - reported_drops) + " log records dropped, queue full";
+                rec.error = true;
+                rec.console = false;
+                Append(rec);
+                reported_drops = dropped;
+            }
+            if (!_msgBatch.empty() || !_errBatch.empty())
+            {
+                WriteBatch();
+            }
+            _written += count;
+            if (count > 0)
+            {
+                idle = 0;
+                continue;
+            }
+            if (_stop)
+            {
+                //records pushed before the stop may still be landing: leave only once nobody is pushing and the ring is empty
+                if (_producers.load() == 0 && _queue.Empty())
+                {
+                    return;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            //nothing to do: back off from spinning to short sleeps
+            if (++idle < 16)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    const std::string& FormatTime(std::chrono::system_clock::time_point time)
+    {
+        auto seconds = std::chrono::system_clock::to_time_t(time);
+        if (seconds != _cached_second || _cached_time.empty())
+        {
+            _cached_second = seconds;
+            _cached_time = p_time::to_simple_string(boost::date_time::c_local_adjustor<p_time::ptime>::utc_to_local(p_time::from_time_t(seconds)));
+        }
+        return _cached_time;
+    }
+
+    void Append(const Record& rec)
+    {
+        auto start = _msgBatch.size();
+        _msgBatch += FormatTime(rec.time);
+        _msgBatch += ',';
+        _msgBatch += rec.sender;
+        _msgBatch += rec.error ? ",Error: " : ",Message: ";
+        _msgBatch += rec.message;
+        _msgBatch += '\n';
+        if (rec.error)
+        {
+            _errBatch.append(_msgBatch, start, std::string::npos);
+        }
+        if (rec.console || (rec.error && !_openedFiles))
+        {
+            auto& out = rec.error ? std::cerr : std::cout;
+            out.write(_msgBatch.data() + start, _msgBatch.size() - start);
+        }
+    }
+
+    void WriteBatch()
+    {
+        std::lock_guard<std::recursive_mutex> lock(_file_mutex);
+        RecheckFileTime();
+        if (_openedFiles)
+        {
+            //errors are in both batches, like BasicLogger::LogError writes them to both files
+            _msgFile.write(_msgBatch.data(), _msgBatch.size());
+            _errFile.write(_errBatch.data(), _errBatch.size());
+            _msgFile.flush();
+            if (!_errBatch.empty())
+            {
+                _errFile.flush();
+            }
+        }
+        _msgBatch.clear();
+        _errBatch.clear();
+    }
+};
+
+#endif //ASYNCLOGGER_H__
@@ -5,19 +5,69 @@
 #include <string>
 #include <sstream>
 #include <queue>
+#include <type_traits>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 //#define default_log std::cout
 //#define default_err std::cerr
 
+/*Compile-time floor for the LOG_* macros below: 0 - debug, 1 - info, 2 - warning, 3 - error, 4 - off.
+Calls under it compile to nothing.*/
+#ifndef EXINITY_LOG_MIN_LEVEL
+#define EXINITY_LOG_MIN_LEVEL 0
+#endif
+
 namespace p_time = boost::posix_time;
 
+enum class LogLevel
+{
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+    Off = 4
+};
+
 class ILogger
 {
 protected:
+    LogLevel _level = LogLevel::Info;
+
     ILogger() {};
 public:
 
+    /*Runtime level check used by the LOG_* macros; messages below the level are never formatted.*/
+    virtual bool IsEnabled(LogLevel level) const
+    {
+        return level >= _level && level != LogLevel::Off;
+    }
+
+    void SetLevel(LogLevel level)
+    {
+        _level = level;
+    }
+
+    LogLevel GetLevel() const
+    {
+        return _level;
+    }
+
+    void Log(LogLevel level, const std::string& sender, const std::string& message, bool alsoLogToConsole)
+    {
+        if (level >= LogLevel::Error)
+        {
+            LogError(sender, message, alsoLogToConsole);
+        }
+        else if (level == LogLevel::Warning)
+        {
+            LogMessage(sender, "Warning: " + message, alsoLogToConsole);
+        }
+        else
+        {
+            LogMessage(sender, message, alsoLogToConsole);
+        }
+    }
+
     /*sets output to filenameBase+extension (messages and errors) and filenameBase+"_Errors"+extension*/
     virtual bool AssignFiles(const std::string& filenameBase, const std::string& extension = ".log") = 0;
     virtual bool AssignFiles(const std::string& filenameBase, const p_time::ptime& time, const std::string& extension = ".log", const p_time::time_duration& recreation_period = p_time::hours(24)) = 0;
@@ -63,7 +113,75 @@ public:
 
     virtual void LogError(const std::string& sender, const  std::stringstream& message, bool alsoLogToConsole = false) override {}
 
+    virtual bool IsEnabled(LogLevel /*level*/) const override { return false; }
+
     virtual ~EmptyLogger() {}
 };
 
+
+/*LogFormat("connected to {} from {}", a, b): substitutes "{}" placeholders in order.
+Strings and numbers are appended directly, anything else goes through operator<<.*/
+namespace log_detail
+{
+    inline void Append(std::string& out, const std::string& value) { out += value; }
+    inline void Append(std::string& out, const char* value) { out += value; }
+    inline void Append(std::string& out, char value) { out += value; }
+    inline void Append(std::string& out, bool value) { out += value ? "true" : "false"; }
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type Append(std::string& out, const T& value)
+    {
+        out += std::to_string(value);
+    }
+
+    template<typename T>
+    typename std::enable_if<!std::is_arithmetic<T>::value>::type Append(std::string& out, const T& value)
+    {
+        std::ostringstream ss;
+        ss << value;
+        out += ss.str();
+    }
+
+    inline void Format(std::string& out, const char* fmt)
+    {
+        out += fmt;
+    }
+
+    template<typename Arg, typename... Args>
+    void Format(std::string& out, const char* fmt, const Arg& arg, const Args&... args)
+    {
+        for (; *fmt; ++fmt)
+        {
+            if (fmt[0] == '{' && fmt[1] == '}')
+            {
+                Append(out, arg);
+                Format(out, fmt + 2, args...);
+                return;
+            }
+            out += *fmt;
+        }
+    }
+}
+
+template<typename... Args>
+std::string LogFormat(const char* fmt, const Args&... args)
+{
+    std::string out;
+    log_detail::Format(out, fmt, args...);
+    return out;
+}
+
+/*Arguments are evaluated only when the level passes both the compile-time floor and the logger's runtime level,
+so a disabled call costs one branch and no allocation.*/
+#define LOG_ENABLED(logger, level) (static_cast<int>(level) >= EXINITY_LOG_MIN_LEVEL && (logger)->IsEnabled(level))
+
+#define EXINITY_LOG(logger, level, console, sender, ...) \
+    do { if (LOG_ENABLED(logger, level)) (logger)->Log(level, sender, LogFormat(__VA_ARGS__), console); } while (0)
+
+#define LOG_DEBUG(logger, sender, ...) EXINITY_LOG(logger, LogLevel::Debug, false, sender, __VA_ARGS__)
+#define LOG_INFO(logger, sender, ...) EXINITY_LOG(logger, LogLevel::Info, false, sender, __VA_ARGS__)
+#define LOG_INFO_CONSOLE(logger, sender, ...) EXINITY_LOG(logger, LogLevel::Info, true, sender, __VA_ARGS__)
+#define LOG_WARNING(logger, sender, ...) EXINITY_LOG(logger, LogLevel::Warning, false, sender, __VA_ARGS__)
+#define LOG_ERROR(logger, sender, ...) EXINITY_LOG(logger, LogLevel::Error, true, sender, __VA_ARGS__)
+
 #endif // !LOGGER_H__
\ No newline at end of file
@@ -0,0 +1,269 @@
+#ifndef MESSAGECODEC_H__
+#define MESSAGECODEC_H__
+
+#include <boost/endian/conversion.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/*Compact binary encoding for fixed-layout messages, meant for binary frames (ISocket::SetBinary).
+A message type describes its layout once, by visiting its fields in wire order. Visit is a static template
+over the message's constness, so encoding sees const fields and decoding mutable ones from the same list:
+
+    struct Quote
+    {
+        static constexpr uint32_t Id = 1;
+        VarUInt seq;
+        double bid = 0, ask = 0;
+        std::string_view symbol;
+
+        template<typename Self, typename Visitor>
+        static void Visit(Self& self, Visitor& v) { v(self.seq); v(self.bid); v(self.ask); v(self.symbol); }
+    };
+
+The wire form is the type id as a varint followed by the fields: arithmetic types and enums little-endian
+at their fixed width, VarUInt/VarInt as LEB128 varints (VarInt zigzagged), strings as a varint length plus
+the bytes. Decoding into std::string_view fields copies nothing - they point into the decoded buffer,
+e.g. a MessageView's, and are valid as long as it is.*/
+
+struct VarUInt
+{
+    uint64_t value = 0;
+};
+
+struct VarInt
+{
+    int64_t value = 0;
+};
+
+
+class CodecWriter
+{
+protected:
+
+    std::string& _out;
+
+public:
+
+    explicit CodecWriter(std::string& out) : _out(out) {}
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type operator()(const T& value)
+    {
+        Fixed(value);
+    }
+
+    void operator()(const VarUInt& value)
+    {
+        Varint(value.value);
+    }
+
+    void operator()(const VarInt& value)
+    {
+        Varint((static_cast<uint64_t>(value.value) << 1) ^ static_cast<uint64_t>(value.value >> 63));
+    }
+
+    void operator()(std::string_view value)
+    {
+        Varint(value.size());
+        _out.append(value.data(), value.size());
+    }
+
+    void operator()(const std::string& value)
+    {
+        (*this)(std::string_view(value));
+    }
+
+    void Varint(uint64_t value)
+    {
+        char buf[10];
+        size_t n = 0;
+        while (value >= 0x80)
+        {
+            buf[n++] = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        buf[n++] = static_cast<char>(value);
+        _out.append(buf, n);
+    }
+
+protected:
+
+    template<typename T>
+    void Fixed(T value)
+    {
+        using Bits = typename std::conditional<sizeof(T) == 1, uint8_t,
+            typename std::conditional<sizeof(T) == 2, uint16_t,
+            typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type;
+        static_assert(sizeof(T) == sizeof(Bits), "unsupported field width");
+        Bits bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits = boost::endian::native_to_little(bits);
+        _out.append(reinterpret_cast<const char*>(&bits), sizeof(bits));
+    }
+};
+
+
+/*Reads fields in order; after the first short or malformed field it stops and Ok() turns false.*/
+class CodecReader
+{
+protected:
+
+    const char* _pos;
+    const char* _end;
+    bool _ok = true;
+
+public:
+
+    explicit CodecReader(std::string_view data) : _pos(data.data()), _end(data.data() + data.size()) {}
+
+    bool Ok() const
+    {
+        return _ok;
+    }
+
+    size_t Remaining() const
+    {
+        return static_cast<size_t>(_end - _pos);
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type operator()(T& value)
+    {
+        Fixed(value);
+    }
+
+    /*Only 0 and 1 are bools; copying any other byte into one would make an invalid value.*/
+    void operator()(bool& value)
+    {
+        uint8_t byte = 0;
+        Fixed(byte);
+        if (byte > 1)
+        {
+            _ok = false;
+            byte = 0;
+        }
+        value = byte != 0;
+    }
+
+    void operator()(VarUInt& value)
+    {
+        value.value = Varint();
+    }
+
+    void operator()(VarInt& value)
+    {
+        auto raw = Varint();
+        value.value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+    }
+
+    void operator()(std::string_view& value)
+    {
+        auto size = Varint();
+        if (!_ok || size > Remaining())
+        {
+            _ok = false;
+            value = {};
+            return;
+        }
+        value = std::string_view(_pos, static_cast<size_t>(size));
+        _pos += size;
+    }
+
+    void operator()(std::string& value)
+    {
+        std::string_view view;
+        (*this)(view);
+        value.assign(view.data(), view.size());
+    }
+
+    uint64_t Varint()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; _ok && shift < 64; shift += 7)
+        {
+            if (_pos == _end)
+            {
+                break;
+            }
+            auto byte = static_cast<uint8_t>(*_pos++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+        _ok = false;
+        return 0;
+    }
+
+protected:
+
+    template<typename T>
+    void Fixed(T& value)
+    {
+        using Bits = typename std::conditional<sizeof(T) == 1, uint8_t,
+            typename std::conditional<sizeof(T) == 2, uint16_t,
+            typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type;
+        static_assert(sizeof(T) == sizeof(Bits), "unsupported field width");
+        if (!_ok || Remaining() < sizeof(Bits))
+        {
+            _ok = false;
+            return;
+        }
+        Bits bits;
+        std::memcpy(&bits, _pos, sizeof(bits));
+        bits = boost::endian::little_to_native(bits);
+        std::memcpy(&value, &bits, sizeof(bits));
+        _pos += sizeof(bits);
+    }
+};
+
+
+class MessageCodec
+{
+public:
+
+    /*Appends the message to `out`, so one buffer can be reused for every send.*/
+    template<typename Message>
+    static void Encode(const Message& msg, std::string& out)
+    {
+        CodecWriter writer(out);
+        writer.Varint(Message::Id);
+        Message::Visit(msg, writer);
+    }
+
+    template<typename Message>
+    static std::string Encode(const Message& msg)
+    {
+        std::string out;
+        Encode(msg, out);
+        return out;
+    }
+
+    /*The type id a frame starts with, to pick the type to decode it as; false for an empty or broken frame.*/
+    static bool PeekId(std::string_view data, uint32_t& id)
+    {
+        CodecReader reader(data);
+        auto value = reader.Varint();
+        id = static_cast<uint32_t>(value);
+        return reader.Ok() && value <= UINT32_MAX;
+    }
+
+    /*False if the frame is of another type, is short or has bytes left over.*/
+    template<typename Message>
+    static bool Decode(std::string_view data, Message& msg)
+    {
+        CodecReader reader(data);
+        if (reader.Varint() != Message::Id || !reader.Ok())
+        {
+            return false;
+        }
+        Message::Visit(msg, reader);
+        return reader.Ok() && reader.Remaining() == 0;
+    }
+};
+
+#endif //MESSAGECODEC_H__
@@ -0,0 +1,437 @@
+#ifndef RECONNECTSUPERVISOR_H__
+#define RECONNECTSUPERVISOR_H__
+
+#include "Socket.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+
+/*Keeps a connection up without blocking anybody. The active socket's read loop and every write through Send
+report failures immediately; the supervisor then reconnects asynchronously - the first attempt right away,
+later ones after an exponentially growing, jittered delay. With `standby` set a second, already connected
+socket is kept aside and promoted on failure, so traffic resumes without waiting for a connect at all.
+The standby runs its own read loop (and heartbeat), so it is replaced as soon as it dies rather than found
+dead on promotion; whatever it receives is dropped. With `heartbeat` set a peer that stops answering pings
+counts as a failure too.
+Sockets must be driven by an EventLoop (they run read loops).*/
+class ReconnectSupervisor : public std::enable_shared_from_this<ReconnectSupervisor>
+{
+public:
+
+    using SocketMaker = std::function<std::shared_ptr<ISocket>()>;
+    /*`up` is false when the connection was lost and true once traffic can flow again.*/
+    using StateHandler = std::function<void(bool up)>;
+
+    struct Options
+    {
+        std::chrono::milliseconds initial_backoff{ 100 };   //delay before the second attempt
+        std::chrono::milliseconds max_backoff{ 10000 };
+        double multiplier = 2.0;
+        double jitter = 0.5;                                //a delay is shortened by up to this fraction at random
+        bool standby = false;                               //a second connection to the same server, kept idle
+        bool heartbeat = false;                             //ping the sockets, a dead peer counts as a failure
+        HeartbeatOptions heartbeat_options;
+    };
+
+protected:
+
+    struct Slot
+    {
+        std::shared_ptr<ISocket> socket;
+        std::unique_ptr<net::steady_timer> timer;
+        unsigned attempts = 0;
+        uint64_t generation = 0;    //bumped per connect, so late failures of an old connection are ignored
+        bool ready = false;
+    };
+
+    net::io_context& _ioc;
+    SocketMaker _make;
+    std::string _uri, _port;
+    Options _opt;
+    std::mutex _mutex;
+    Slot _active, _standby;
+    std::atomic<const ISocket*> _delivering{ nullptr };    //the active socket, whose messages go to _on_message
+    bool _running = false;
+    std::mt19937 _rng{ std::random_device()() };
+    ISocket::ReadHandler _on_message;
+    StateHandler _on_state;
+    uint64_t _reconnects = 0;
+    uint64_t _failovers = 0;
+
+public:
+
+    ReconnectSupervisor(net::io_context& ioc, SocketMaker make, const std::string& uri, const std::string& port)
+        : ReconnectSupervisor(ioc, std::move(make), uri, port, Options())
+    {
+    }
+
+    ReconnectSupervisor(net::io_context& ioc, SocketMaker make, const std::string& uri, const std::string& port, Options opt)
+        : _ioc(ioc), _make(std::move(make)), _uri(uri), _port(port), _opt(opt)
+    {
+    }
+
+    /*Messages received on whichever socket is active, on that socket's strand. Set before Start.*/
+    void OnMessage(ISocket::ReadHandler handler)
+    {
+        _on_message = std::move(handler);
+    }
+
+    void OnStateChange(StateHandler handler)
+    {
+        _on_state = std::move(handler);
+    }
+
+    void Start()
+    {
+        std::vector<std::shared_ptr<ISocket>> connect;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_running)
+            {
+                return;
+            }
+            _running = true;
+            _active.socket = _make();
+            connect.push_back(_active.socket);
+            if (_opt.standby)
+            {
+                _standby.socket = _make();
+                connect.push_back(_standby.socket);
+            }
+        }
+        for (auto& socket : connect)
+        {
+            Connect(socket, false);
+        }
+    }
+
+    /*Closes the sockets; `done` (if any) runs once they are all closed.*/
+    void Stop(std::function<void()> done = nullptr)
+    {
+        std::vector<std::shared_ptr<ISocket>> sockets;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+            for (auto slot : { &_active, &_standby })
+            {
+                if (slot->timer)
+                {
+                    slot->timer->cancel();
+                }
+                if (slot->socket && slot->ready)
+                {
+                    //sockets still reconnecting are left to their destructor
+                    sockets.push_back(slot->socket);
+                }
+                slot->ready = false;
+            }
+        }
+        if (sockets.empty() && done)
+        {
+            done();
+            return;
+        }
+        auto remaining = std::make_shared<std::atomic<size_t>>(sockets.size());
+        for (auto& socket : sockets)
+        {
+            socket->StopReadLoop();
+            socket->AsyncClose([socket, remaining, done](boost::system::error_code)
+                {
+                    if (--*remaining == 0 && done)
+                    {
+                        done();
+                    }
+                });
+        }
+    }
+
+    /*Writes through the active socket. Fails with not_connected while there is none; a failed write starts
+    the recovery.*/
+    void Send(std::string data, ISocket::CompletionHandler handler = nullptr)
+    {
+        std::shared_ptr<ISocket> socket;
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_active.ready)
+            {
+                socket = _active.socket;
+                generation = _active.generation;
+            }
+        }
+        if (!socket)
+        {
+            if (handler)
+            {
+                handler(net::error::not_connected);
+            }
+            return;
+        }
+        std::weak_ptr<ReconnectSupervisor> weak = shared_from_this();
+        socket->Enqueue(std::move(data), [weak, socket, generation, handler = std::move(handler)](boost::system::error_code ec)
+            {
+                auto self = weak.lock();
+                if (ec && self)
+                {
+                    self->Failure(socket, generation, ec);
+                }
+                if (handler)
+                {
+                    handler(ec);
+                }
+            });
+    }
+
+    /*For failures noticed outside the supervisor, e.g. a missed heartbeat on the active socket.*/
+    void ReportFailure(std::shared_ptr<ISocket> socket, boost::system::error_code ec)
+    {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto slot = Find(socket);
+            if (!slot)
+            {
+                return;
+            }
+            generation = slot->generation;
+        }
+        Failure(socket, generation, ec);
+    }
+
+    std::shared_ptr<ISocket> Socket()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _active.socket;
+    }
+
+    bool IsUp()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _active.ready;
+    }
+
+    uint64_t Reconnects()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _reconnects;
+    }
+
+    uint64_t Failovers()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _failovers;
+    }
+
+    virtual ~ReconnectSupervisor()
+    {
+    }
+
+protected:
+
+    Slot* Find(const std::shared_ptr<ISocket>& socket)
+    {
+        if (_active.socket == socket)
+        {
+            return &_active;
+        }
+        if (_standby.socket == socket)
+        {
+            return &_standby;
+        }
+        return nullptr;
+    }
+
+    void Connect(std::shared_ptr<ISocket> socket, bool reconnect)
+    {
+        std::weak_ptr<ReconnectSupervisor> weak = shared_from_this();
+        auto done = [weak, socket](boost::system::error_code ec)
+        {
+            if (auto self = weak.lock())
+            {
+                self->OnConnected(socket, ec);
+            }
+        };
+        if (reconnect)
+        {
+            socket->AsyncReConnect(std::move(done));
+        }
+        else
+        {
+            socket->AsyncConnect(_uri, _port, std::move(done));
+        }
+    }
+
+    void OnConnected(std::shared_ptr<ISocket> socket, boost::system::error_code ec)
+    {
+        bool went_up = false;
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto slot = Find(socket);
+            if (!_running || !slot)
+            {
+                return;
+            }
+            if (ec)
+            {
+                Schedule(*slot);
+                return;
+            }
+            if (slot->attempts > 0)
+            {
+                ++_reconnects;
+            }
+            slot->attempts = 0;
+            slot->ready = true;
+            ++slot->generation;
+            if (slot == &_standby && !_active.ready)
+            {
+                //the standby made it first: it becomes the active socket, the other one keeps trying as standby
+                std::swap(_active, _standby);
+                slot = &_active;
+            }
+            if (slot == &_active)
+            {
+                _delivering = _active.socket.get();
+            }
+            generation = slot->generation;
+            went_up = slot == &_active;
+        }
+        if (Watch(socket, generation) && went_up && _on_state)
+        {
+            _on_state(true);
+        }
+    }
+
+    /*Runs a connected socket's read loop and heartbeat, the standby's as well as the active one's. The end of
+    the loop is the earliest sign of a dead connection. False if it couldn't start; the failure is handled.*/
+    bool Watch(std::shared_ptr<ISocket> socket, uint64_t generation)
+    {
+        std::weak_ptr<ReconnectSupervisor> weak = shared_from_this();
+        auto started = socket->StartReadLoop(0, [weak, socket, generation](boost::system::error_code ec, std::string msg)
+            {
+                auto self = weak.lock();
+                if (!self)
+                {
+                    return;
+                }
+                if (ec)
+                {
+                    self->Failure(socket, generation, ec);
+                    return;
+                }
+                if (self->_on_message && self->_delivering == socket.get())
+                {
+                    self->_on_message(ec, std::move(msg));
+                }
+            });
+        if (!started)
+        {
+            Failure(socket, generation, net::error::not_connected);
+            return false;
+        }
+        if (_opt.heartbeat)
+        {
+            auto beating = socket->StartHeartbeat(_opt.heartbeat_options, [weak, socket, generation](boost::system::error_code ec)
+                {
+                    if (auto self = weak.lock())
+                    {
+                        self->Failure(socket, generation, ec);
+                    }
+                });
+            if (!beating)
+            {
+                //the read loop has already ended, and reported it
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Failure(std::shared_ptr<ISocket> socket, uint64_t generation, boost::system::error_code ec)
+    {
+        boost::ignore_unused(ec);
+        std::shared_ptr<ISocket> promoted;
+        bool went_down = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto slot = Find(socket);
+            if (!_running || !slot || !slot->ready || slot->generation != generation)
+            {
+                //stopped, not ours, recovery is already under way or it is about an earlier connection
+                return;
+            }
+            slot->ready = false;
+            if (slot == &_active && _standby.ready)
+            {
+                std::swap(_active, _standby);
+                ++_failovers;
+                _delivering = _active.socket.get();
+                promoted = _active.socket;
+                Schedule(_standby);
+            }
+            else
+            {
+                went_down = slot == &_active;
+                Schedule(*slot);
+            }
+        }
+        socket->StopReadLoop();
+        socket->StopHeartbeat();
+        if (promoted && _on_state)
+        {
+            //already connected and watched; traffic moves over without a gap
+            _on_state(true);
+        }
+        else if (went_down && _on_state)
+        {
+            _on_state(false);
+        }
+    }
+
+    /*Must be called under _mutex.*/
+    void Schedule(Slot& slot)
+    {
+        auto delay = Backoff(slot.attempts++);
+        auto socket = slot.socket;
+        if (delay.count() == 0)
+        {
+            net::post(_ioc, [self = shared_from_this(), socket]() { self->Connect(socket, true); });
+            return;
+        }
+        if (!slot.timer)
+        {
+            slot.timer = std::make_unique<net::steady_timer>(_ioc);
+        }
+        slot.timer->expires_after(delay);
+        std::weak_ptr<ReconnectSupervisor> weak = shared_from_this();
+        slot.timer->async_wait([weak, socket](boost::system::error_code ec)
+            {
+                auto self = weak.lock();
+                if (!ec && self)
+                {
+                    self->Connect(socket, true);
+                }
+            });
+    }
+
+    /*0 for the first attempt, then initial_backoff * multiplier^n capped at max_backoff, minus the jitter.*/
+    std::chrono::milliseconds Backoff(unsigned attempt)
+    {
+        if (attempt == 0)
+        {
+            return std::chrono::milliseconds(0);
+        }
+        double delay = static_cast<double>(_opt.initial_backoff.count());
+        for (unsigned i = 1; i < attempt && delay < _opt.max_backoff.count(); ++i)
+        {
+            delay *= _opt.multiplier;
+        }
+        delay = (std::min)(delay, static_cast<double>(_opt.max_backoff.count()));
+        delay *= 1.0 - _opt.jitter * std::uniform_real_distribution<double>(0, 1)(_rng);
+        return std::chrono::milliseconds(static_cast<int64_t>(delay));
+    }
+};
+
+#endif //RECONNECTSUPERVISOR_H__
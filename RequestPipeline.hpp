@@ -0,0 +1,329 @@
+#ifndef REQUESTPIPELINE_H__
+#define REQUESTPIPELINE_H__
+
+#include "Socket.hpp"
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+/*Correlates responses with requests so one connection can carry many outstanding requests.
+Every outbound payload is tagged with an id (by default "<id>|<payload>"), the id of every inbound message
+is extracted (by default everything before the first '|') and the matching handler is completed.
+Needs a socket driven by an EventLoop: it runs the socket's read loop with its own handler.*/
+class RequestPipeline : public std::enable_shared_from_this<RequestPipeline>
+{
+public:
+
+    using ResponseHandler = ISocket::ReadHandler;
+    using Tagger = std::function<std::string(const std::string& id, const std::string& payload)>;
+    /*Returns the id carried by a message, or an empty string for messages that answer no request.*/
+    using KeyExtractor = std::function<std::string(const std::string& message)>;
+
+    struct Options
+    {
+        size_t window = 256;                                    //max requests written but not yet answered
+        std::chrono::milliseconds deadline{ 5000 };             //default per-request deadline
+        std::chrono::milliseconds resolution{ 10 };             //how often deadlines are checked
+        Tagger tagger;
+        KeyExtractor key_extractor;
+        ResponseHandler unsolicited;                            //receives messages without a pending request
+    };
+
+protected:
+
+    using Deadlines = std::multimap<std::chrono::steady_clock::time_point, std::string>;
+
+    struct Pending
+    {
+        std::string message;
+        ResponseHandler handler;
+        Deadlines::iterator deadline;
+        bool sent = false;
+    };
+
+    /*Messages taken into the window, to be handed to the socket once _mutex is released.*/
+    using Outgoing = std::vector<std::pair<std::string, std::string>>;
+
+    std::shared_ptr<ISocket> _socket;
+    Options _opt;
+    net::steady_timer _timer;
+    std::mutex _mutex;
+    std::unordered_map<std::string, Pending> _inflight;
+    Deadlines _deadlines;                       //ordered, so expiry only looks at the overdue ones
+    std::deque<std::string> _backlog;
+    size_t _in_window = 0;
+    bool _running = false;
+    uint64_t _next_id = 0;
+
+public:
+
+    RequestPipeline(std::shared_ptr<ISocket> socket, net::io_context& ioc) : RequestPipeline(std::move(socket), ioc, Options())
+    {
+    }
+
+    RequestPipeline(std::shared_ptr<ISocket> socket, net::io_context& ioc, Options opt) : _socket(std::move(socket)), _opt(std::move(opt)), _timer(ioc)
+    {
+        if (!_opt.tagger)
+        {
+            _opt.tagger = [](const std::string& id, const std::string& payload) { return id + "|" + payload; };
+        }
+        if (!_opt.key_extractor)
+        {
+            _opt.key_extractor = [](const std::string& message) { return message.substr(0, std::min(message.find('|'), message.length())); };
+        }
+        if (_opt.window == 0)
+        {
+            _opt.window = 1;
+        }
+    }
+
+    bool Start()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = true;
+        }
+        std::weak_ptr<RequestPipeline> weak = shared_from_this();
+        if (!_socket->StartReadLoop(0, [weak](boost::system::error_code ec, std::string msg)
+            {
+                if (auto self = weak.lock())
+                {
+                    self->OnMessage(ec, std::move(msg));
+                }
+            }))
+        {
+            return false;
+        }
+        ArmTimer();
+        return true;
+    }
+
+    /*Fails every outstanding request with operation_aborted.*/
+    void Stop()
+    {
+        _socket->StopReadLoop();
+        _timer.cancel();
+        FailAll(net::error::operation_aborted);
+    }
+
+    void Submit(const std::string& payload, ResponseHandler handler)
+    {
+        Submit(payload, std::move(handler), _opt.deadline);
+    }
+
+    void Submit(const std::string& payload, ResponseHandler handler, std::chrono::milliseconds deadline)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_running)
+        {
+            lock.unlock();
+            handler(net::error::not_connected, "");
+            return;
+        }
+        auto id = std::to_string(++_next_id);
+        auto& entry = _inflight[id];
+        entry.message = _opt.tagger(id, payload);
+        entry.handler = std::move(handler);
+        entry.deadline = _deadlines.emplace(std::chrono::steady_clock::now() + deadline, id);
+        _backlog.push_back(std::move(id));
+        auto outgoing = Pump();
+        lock.unlock();
+        Send(std::move(outgoing));
+    }
+
+    std::future<std::string> Submit(const std::string& payload)
+    {
+        auto prom = std::make_shared<std::promise<std::string>>();
+        auto fut = prom->get_future();
+        Submit(payload, [prom](boost::system::error_code ec, std::string msg)
+            {
+                if (ec)
+                {
+                    prom->set_exception(std::make_exception_ptr(socket_except("RequestPipeline: " + ec.message())));
+                    return;
+                }
+                prom->set_value(std::move(msg));
+            });
+        return fut;
+    }
+
+    size_t Outstanding()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _inflight.size();
+    }
+
+    virtual ~RequestPipeline()
+    {
+    }
+
+protected:
+
+    /*Moves backlog entries into the window; must be called under _mutex. The result goes to Send once it is released,
+    because the write queue may complete (and call OnWriteFailed) inline.*/
+    Outgoing Pump()
+    {
+        Outgoing outgoing;
+        while (_in_window < _opt.window && !_backlog.empty())
+        {
+            auto id = std::move(_backlog.front());
+            _backlog.pop_front();
+            auto it = _inflight.find(id);
+            if (it == _inflight.end())
+            {
+                continue;
+            }
+            it->second.sent = true;
+            ++_in_window;
+            outgoing.emplace_back(std::move(id), std::move(it->second.message));
+        }
+        return outgoing;
+    }
+
+    void Send(Outgoing outgoing)
+    {
+        std::weak_ptr<RequestPipeline> weak = shared_from_this();
+        for (auto& out : outgoing)
+        {
+            _socket->Enqueue(std::move(out.second), [weak, id = std::move(out.first)](boost::system::error_code ec)
+                {
+                    auto self = weak.lock();
+                    if (ec && self)
+                    {
+                        self->OnWriteFailed(id, ec);
+                    }
+                });
+        }
+    }
+
+    void OnWriteFailed(const std::string& id, boost::system::error_code ec)
+    {
+        ResponseHandler handler;
+        Outgoing outgoing;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            handler = Take(id);
+            outgoing = Pump();
+        }
+        Send(std::move(outgoing));
+        if (handler)
+        {
+            handler(ec, "");
+        }
+    }
+
+    void OnMessage(boost::system::error_code ec, std::string msg)
+    {
+        if (ec)
+        {
+            FailAll(ec);
+            return;
+        }
+        auto id = _opt.key_extractor(msg);
+        ResponseHandler handler;
+        Outgoing outgoing;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!id.empty())
+            {
+                handler = Take(id);
+            }
+            outgoing = Pump();
+        }
+        Send(std::move(outgoing));
+        if (handler)
+        {
+            handler(ec, std::move(msg));
+        }
+        else if (_opt.unsolicited)
+        {
+            _opt.unsolicited(ec, std::move(msg));
+        }
+    }
+
+    /*Removes the request from the table; must be called under _mutex.*/
+    ResponseHandler Take(const std::string& id)
+    {
+        auto it = _inflight.find(id);
+        if (it == _inflight.end())
+        {
+            return nullptr;
+        }
+        auto handler = std::move(it->second.handler);
+        if (it->second.sent && _in_window > 0)
+        {
+            --_in_window;
+        }
+        _deadlines.erase(it->second.deadline);
+        _inflight.erase(it);
+        return handler;
+    }
+
+    void FailAll(boost::system::error_code ec)
+    {
+        std::vector<ResponseHandler> failed;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _running = false;
+            for (auto& entry : _inflight)
+            {
+                failed.push_back(std::move(entry.second.handler));
+            }
+            _inflight.clear();
+            _deadlines.clear();
+            _backlog.clear();
+            _in_window = 0;
+        }
+        for (auto& handler : failed)
+        {
+            handler(ec, "");
+        }
+    }
+
+    void ArmTimer()
+    {
+        _timer.expires_after(_opt.resolution);
+        std::weak_ptr<RequestPipeline> weak = shared_from_this();
+        _timer.async_wait([weak](boost::system::error_code ec)
+            {
+                auto self = weak.lock();
+                if (ec || !self)
+                {
+                    return;
+                }
+                self->ExpireOverdue();
+                self->ArmTimer();
+            });
+    }
+
+    void ExpireOverdue()
+    {
+        std::vector<ResponseHandler> expired;
+        Outgoing outgoing;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto now = std::chrono::steady_clock::now();
+            while (!_deadlines.empty() && _deadlines.begin()->first <= now)
+            {
+                auto first = _deadlines.begin();
+                if (!_inflight.count(first->second))
+                {
+                    _deadlines.erase(first);
+                    continue;
+                }
+                //Take erases the deadline entry too
+                expired.push_back(Take(std::string(first->second)));
+            }
+            outgoing = Pump();
+        }
+        Send(std::move(outgoing));
+        for (auto& handler : expired)
+        {
+            handler(net::error::timed_out, "");
+        }
+    }
+};
+
+#endif //REQUESTPIPELINE_H__
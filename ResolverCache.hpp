@@ -0,0 +1,242 @@
+#ifndef RESOLVERCACHE_H__
+#define RESOLVERCACHE_H__
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*Thread-safe cache of DNS results keyed by "host:port", shared by all sockets of a factory.
+Positive results live `ttl`, failures `negative_ttl`. A lookup that hits an entry within `refresh_before` of its
+expiry still answers from the cache and starts a background re-resolve; concurrent misses for one key share
+a single lookup. Pinned entries never expire and are never re-resolved.*/
+class ResolverCache : public std::enable_shared_from_this<ResolverCache>
+{
+public:
+
+    using tcp = boost::asio::ip::tcp;
+    using Results = tcp::resolver::results_type;
+    using ResolveHandler = std::function<void(boost::system::error_code, Results)>;
+    using clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        std::chrono::milliseconds ttl{ 60000 };
+        std::chrono::milliseconds negative_ttl{ 5000 };
+        std::chrono::milliseconds refresh_before{ 10000 };
+    };
+
+    struct Counters
+    {
+        uint64_t hits = 0;
+        uint64_t negative_hits = 0;
+        uint64_t misses = 0;
+        uint64_t refreshes = 0;
+    };
+
+protected:
+
+    struct Waiter
+    {
+        boost::asio::any_io_executor executor;
+        ResolveHandler handler;
+    };
+
+    struct Entry
+    {
+        Results results;
+        boost::system::error_code error;
+        clock::time_point expires;
+        bool valid = false;
+        bool pinned = false;
+        bool resolving = false;
+        std::vector<Waiter> waiters;
+    };
+
+    Options _opt;
+    std::mutex _mutex;
+    std::unordered_map<std::string, Entry> _entries;
+    std::atomic<uint64_t> _hits{ 0 }, _negative_hits{ 0 }, _misses{ 0 }, _refreshes{ 0 };
+
+public:
+
+    ResolverCache() : ResolverCache(Options())
+    {
+    }
+
+    explicit ResolverCache(Options opt) : _opt(opt)
+    {
+    }
+
+    static std::string Key(const std::string& host, const std::string& port)
+    {
+        return host + ":" + port;
+    }
+
+    /*Answers from the cache synchronously (the handler runs before this returns) or resolves on `executor`
+    and invokes the handler there.*/
+    void AsyncResolve(const std::string& host, const std::string& port, boost::asio::any_io_executor executor, ResolveHandler handler)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto& entry = _entries[Key(host, port)];
+        auto now = clock::now();
+        if (entry.valid && (entry.pinned || now < entry.expires))
+        {
+            auto results = entry.results;
+            auto error = entry.error;
+            bool refresh = !entry.pinned && !error && !entry.resolving && entry.expires - now <= _opt.refresh_before;
+            if (refresh)
+            {
+                entry.resolving = true;
+                ++_refreshes;
+            }
+            lock.unlock();
+            ++(error ? _negative_hits : _hits);
+            if (refresh)
+            {
+                Lookup(host, port, executor);
+            }
+            handler(error, std::move(results));
+            return;
+        }
+        ++_misses;
+        entry.waiters.push_back(Waiter{ executor, std::move(handler) });
+        if (entry.resolving)
+        {
+            return;
+        }
+        entry.resolving = true;
+        lock.unlock();
+        Lookup(host, port, executor);
+    }
+
+    /*Static addresses for `host:port`; lookups never touch DNS for it until unpinned.*/
+    void Pin(const std::string& host, const std::string& port, const std::vector<tcp::endpoint>& endpoints)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& entry = _entries[Key(host, port)];
+        entry.results = Results::create(endpoints.begin(), endpoints.end(), host, port);
+        entry.error.clear();
+        entry.valid = true;
+        entry.pinned = true;
+    }
+
+    void Unpin(const std::string& host, const std::string& port)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(Key(host, port));
+        if (it != _entries.end() && it->second.pinned)
+        {
+            it->second.pinned = false;
+            it->second.valid = false;
+        }
+    }
+
+    /*Keeps answering with the current addresses but re-resolves on the next lookup, e.g. after connecting to
+    them failed. Pinned entries are left alone.*/
+    void MarkStale(const std::string& host, const std::string& port)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(Key(host, port));
+        if (it == _entries.end() || it->second.pinned || !it->second.valid)
+        {
+            return;
+        }
+        if (it->second.error)
+        {
+            it->second.valid = false;
+            return;
+        }
+        it->second.expires = (std::min)(it->second.expires, clock::now() + _opt.refresh_before);
+    }
+
+    void Invalidate(const std::string& host, const std::string& port)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(Key(host, port));
+        if (it != _entries.end() && !it->second.pinned)
+        {
+            it->second.valid = false;
+        }
+    }
+
+    /*Drops everything that is not pinned.*/
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& entry : _entries)
+        {
+            if (!entry.second.pinned)
+            {
+                entry.second.valid = false;
+            }
+        }
+    }
+
+    Counters GetCounters() const
+    {
+        Counters ret;
+        ret.hits = _hits;
+        ret.negative_hits = _negative_hits;
+        ret.misses = _misses;
+        ret.refreshes = _refreshes;
+        return ret;
+    }
+
+protected:
+
+    void Lookup(const std::string& host, const std::string& port, boost::asio::any_io_executor executor)
+    {
+        auto resolver = std::make_shared<tcp::resolver>(executor);
+        auto self = shared_from_this();
+        resolver->async_resolve(host, port, [self, resolver, host, port](boost::system::error_code ec, Results results)
+            {
+                self->OnLookup(host, port, ec, std::move(results));
+            });
+    }
+
+    void OnLookup(const std::string& host, const std::string& port, boost::system::error_code ec, Results results)
+    {
+        std::vector<Waiter> waiters;
+        Results answer;
+        boost::system::error_code answer_ec;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto& entry = _entries[Key(host, port)];
+            entry.resolving = false;
+            waiters.swap(entry.waiters);
+            if (entry.pinned)
+            {
+                answer = entry.results;
+            }
+            else if (!ec || !entry.valid || entry.error || clock::now() >= entry.expires)
+            {
+                //a failed refresh keeps serving the still valid addresses until they expire
+                entry.results = results;
+                entry.error = ec;
+                entry.valid = true;
+                entry.expires = clock::now() + (ec ? _opt.negative_ttl : _opt.ttl);
+                answer = std::move(results);
+                answer_ec = ec;
+            }
+            else
+            {
+                answer = entry.results;
+            }
+        }
+        for (auto& waiter : waiters)
+        {
+            boost::asio::dispatch(waiter.executor, [handler = std::move(waiter.handler), answer, answer_ec]()
+                {
+                    handler(answer_ec, answer);
+                });
+        }
+    }
+};
+
+#endif //RESOLVERCACHE_H__
@@ -0,0 +1,86 @@
+#ifndef SHARDEDRUNTIME_H__
+#define SHARDEDRUNTIME_H__
+
+#include "EventLoop.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+
+/*N single-threaded EventLoops ("shards"), by default one per core. Every socket lives on exactly one shard
+and all of its handlers run there, so thousands of sockets are served by a handful of threads
+without cross-thread locking.*/
+class ShardedRuntime
+{
+protected:
+    std::vector<std::unique_ptr<EventLoop>> _shards;
+    std::atomic<size_t> _next{ 0 };
+    bool _pin;
+
+public:
+
+    explicit ShardedRuntime(size_t shards = 0, bool pin = false) : _pin(pin)
+    {
+        if (shards == 0)
+        {
+            shards = (std::max)(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < shards; ++i)
+        {
+            _shards.push_back(std::make_unique<EventLoop>(1));
+        }
+    }
+
+    ShardedRuntime(const ShardedRuntime&) = delete;
+    ShardedRuntime& operator=(const ShardedRuntime&) = delete;
+
+    void Start()
+    {
+        auto cores = (std::max)(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < _shards.size(); ++i)
+        {
+            _shards[i]->Start();
+            if (_pin)
+            {
+                _shards[i]->PinTo(i % cores);
+            }
+        }
+    }
+
+    void Stop()
+    {
+        for (auto& shard : _shards)
+        {
+            shard->Stop();
+        }
+    }
+
+    size_t Size() const
+    {
+        return _shards.size();
+    }
+
+    EventLoop& Shard(size_t index)
+    {
+        return *_shards[index % _shards.size()];
+    }
+
+    /*Round-robin placement.*/
+    EventLoop& Next()
+    {
+        return Shard(_next.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    /*Stable placement: the same key always lands on the same shard.*/
+    EventLoop& ForKey(const std::string& key)
+    {
+        return Shard(std::hash<std::string>()(key));
+    }
+
+    virtual ~ShardedRuntime()
+    {
+        Stop();
+    }
+};
+
+#endif //SHARDEDRUNTIME_H__
@@ -2,6 +2,12 @@
 #define SOCKET_H__
 
 #include "Logger/Logger.hpp"
+#include "SocketStats.hpp"
+#include "ResolverCache.hpp"
+#include "BufferPool.hpp"
+#include "TlsContext.hpp"
+#include "Histogram.hpp"
+#include "FieldParser.hpp"
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio.hpp>
@@ -15,6 +21,11 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <functional>
+#include <future>
+#include <string_view>
+#include <vector>
+#include <chrono>
 
 
 namespace beast = boost::beast;
@@ -56,19 +67,139 @@ public:
 };
 
 
+class ISocket;
+
+struct HeartbeatOptions
+{
+    std::chrono::milliseconds interval{ 1000 };     //one ping per interval
+    unsigned max_missed = 3;                        //the peer is dead after this many intervals without a pong
+    std::chrono::seconds rtt_window{ 60 };          //how far back RttHistogram looks
+};
+
+/*permessage-deflate (RFC 7692) as offered by the client; the server picks what is actually used.*/
+struct CompressionOptions
+{
+    bool enabled = false;
+    int client_max_window_bits = 15;                //9..15, our compressor's window
+    int server_max_window_bits = 15;                //9..15, the server's compressor window
+    bool client_no_context_takeover = false;        //fresh compressor per message: less memory, worse ratio
+    bool server_no_context_takeover = false;
+    int level = 8;                                  //0..9
+    int mem_level = 4;                              //1..9
+    size_t min_size = 0;                            //smaller messages go uncompressed; needs a Beast with msg_size_threshold
+};
+
+/** Read-only view of a received message that still lives in the socket's receive buffer.
+The buffer is consumed (and the next read may start) only once the view is released or destroyed.
+*/
+class MessageView
+{
+private:
+
+    std::shared_ptr<ISocket> _owner;
+    std::string_view _data;
+
+public:
+
+    MessageView() {}
+
+    MessageView(std::shared_ptr<ISocket> owner, std::string_view data) : _owner(std::move(owner)), _data(data) {}
+
+    MessageView(const MessageView&) = delete;
+    MessageView& operator=(const MessageView&) = delete;
+
+    MessageView(MessageView&& other) noexcept : _owner(std::move(other._owner)), _data(other._data)
+    {
+        other._data = {};
+    }
+
+    MessageView& operator=(MessageView&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            _owner = std::move(other._owner);
+            _data = other._data;
+            other._data = {};
+        }
+        return *this;
+    }
+
+    std::string_view View() const
+    {
+        return _data;
+    }
+
+    net::const_buffer Buffer() const
+    {
+        return net::const_buffer(_data.data(), _data.size());
+    }
+
+    const char* Data() const
+    {
+        return _data.data();
+    }
+
+    size_t Size() const
+    {
+        return _data.size();
+    }
+
+    bool Empty() const
+    {
+        return _data.empty();
+    }
+
+    inline void Release();
+
+    ~MessageView()
+    {
+        Release();
+    }
+};
+
+
 class ISocket : public std::enable_shared_from_this<ISocket>
 {
+    friend class MessageView;
+
 protected:
 
     mutable std::string _err;
     boost::system::error_code _ec;
+    bool _external_loop = false;
+    SocketCounters _stats;
+    std::shared_ptr<ResolverCache> _resolver_cache;
+    std::chrono::milliseconds _op_timeout{ 0 };
+    std::chrono::milliseconds _connect_timeout{ 60000 };
+    CompressionOptions _compression;
+    FieldList _fields;                          //reused by AsyncReadFields; only one view is ever outstanding
 
     ISocket() {}
 
+    /*Sets the error code returned by GetErrorCode and counts it in the stats.*/
+    void SetError(const boost::system::error_code& ec)
+    {
+        _ec = ec;
+        _stats.Error(ec);
+    }
+
     virtual ~ISocket() {}
 
 public:
 
+    using CompletionHandler = std::function<void(boost::system::error_code)>;
+    using ReadHandler = std::function<void(boost::system::error_code, std::string)>;
+    using ViewHandler = std::function<void(boost::system::error_code, MessageView)>;
+    /*`chunk` is only valid during the call; `done` is true for the message's last chunk (or on error).*/
+    using ChunkHandler = std::function<void(boost::system::error_code, std::string_view chunk, bool done)>;
+    /*`fields` point into `view` and are only valid during the call.*/
+    using FieldsHandler = std::function<void(boost::system::error_code, MessageView view, const FieldList& fields)>;
+
+    /*Timeout arguments: DefaultTimeout takes the connection's SetOperationTimeout value, NoTimeout waits forever.*/
+    static constexpr std::chrono::milliseconds DefaultTimeout{ -1 };
+    static constexpr std::chrono::milliseconds NoTimeout{ 0 };
+
     //prefix,URL,port,path
     static std::tuple < std::string, std::string, std::string, std::string > ParseURI(const std::string& address)
     {
@@ -124,18 +255,219 @@ public:
         return _ec;
     }
 
+    /** Connect phase timings, traffic and error counters since the socket was created. Any thread.
+    */
+    SocketStats Stats() const
+    {
+        return _stats.Snapshot();
+    }
+
+    /** Includes the socket in the registry's process-wide aggregate (the factory does this for its sockets).
+    */
+    void AttachStats(std::shared_ptr<SocketStatsRegistry> registry)
+    {
+        _stats.AttachTo(std::move(registry));
+    }
+
+    /** Connects (and reconnects) look the host up in `cache` instead of asking DNS every time; nullptr turns
+    caching off.
+    */
+    void SetResolverCache(std::shared_ptr<ResolverCache> cache)
+    {
+        _resolver_cache = std::move(cache);
+    }
+
+    /** Receive buffers come from `pool` and return to it once a message is consumed (the pool's connection_limit
+    also caps the message size); nullptr gives the socket a private buffer again. Call before connecting.
+    */
+    virtual void SetBufferPool(std::shared_ptr<BufferPool> pool) = 0;
+
+    /** Deadline for reads, writes and pings called with DefaultTimeout. An operation that misses its deadline
+    completes with `net::error::timed_out`. A websocket op can't be cancelled on its own, so an expired read,
+    ping or write in progress closes the connection (reconnect to continue); a write that expires while still
+    queued is just dropped.
+    */
+    void SetOperationTimeout(std::chrono::milliseconds timeout)
+    {
+        _op_timeout = timeout;
+    }
+
+    std::chrono::milliseconds GetOperationTimeout() const
+    {
+        return _op_timeout;
+    }
+
+    /** Limit for resolve, TCP connect, TLS and websocket handshakes together (default 60 s). The lookup itself
+    isn't interrupted, but the time it takes counts against the limit.
+    */
+    void SetConnectTimeout(std::chrono::milliseconds timeout)
+    {
+        _connect_timeout = timeout;
+    }
+
+    /** Offers permessage-deflate on the next connect. Stats() shows what it saves (payload vs wire bytes).
+    */
+    void SetCompression(const CompressionOptions& options)
+    {
+        _compression = options;
+    }
+
+    const CompressionOptions& GetCompression() const
+    {
+        return _compression;
+    }
+
+    /** Marks the io_context as driven by somebody else (e.g. an EventLoop). Blocking calls then wait
+    for their completion instead of running the context themselves.
+    */
+    void SetExternalLoop(bool external)
+    {
+        _external_loop = external;
+    }
+
+    bool HasExternalLoop() const
+    {
+        return _external_loop;
+    }
+
+    /** The strand all of the socket's handlers run on.
+    */
+    virtual net::any_io_executor GetExecutor() = 0;
+
+    /** Runs `work` on the socket's home thread, serialized with its handlers.
+    */
+    void Post(std::function<void()> work)
+    {
+        net::post(GetExecutor(), std::move(work));
+    }
+
     virtual bool Connect(const std::string& uri, const std::string& port) = 0;
     virtual bool ReConnect() = 0;
     virtual bool Close() = 0;
 
-    virtual bool Write(const std::string& data) = 0;
-    virtual bool Ping(const std::string& data) = 0;
-    virtual bool Read(std::string& ret) = 0;
+    virtual bool Write(const std::string& data, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    /** Sends the buffers as a single message, e.g. a header and a payload without concatenating them.
+    */
+    virtual bool Write(const std::vector<net::const_buffer>& buffers, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    virtual bool Ping(const std::string& data, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    virtual bool Read(std::string& ret, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
     /** Returns `true` if the websocket is open. Can get stale until read or write function is called.
     */
     virtual bool IsOpen() = 0;
     virtual size_t AvailableBytes() = 0;
+
+    /** Asynchronous counterparts of the calls above. They only start the operation; the handler is
+    invoked on the socket's strand once it completes. `data` must stay valid until then.
+    */
+    virtual void AsyncConnect(const std::string& uri, const std::string& port, CompletionHandler handler) = 0;
+    virtual void AsyncReConnect(CompletionHandler handler) = 0;
+    virtual void AsyncClose(CompletionHandler handler) = 0;
+
+    /** Writes go through a per-connection queue drained by a single writer, so they may be issued from
+    any thread and any number may be pending.
+    */
+    virtual void AsyncWrite(const std::string& data, CompletionHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    virtual void AsyncWrite(std::vector<net::const_buffer> buffers, CompletionHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    /** Like AsyncWrite, but the queue takes ownership of the message; `handler` may be empty.
+    */
+    virtual void Enqueue(std::string data, CompletionHandler handler = nullptr, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    /** Enqueued messages shorter than `max_bytes` are joined with `separator` into one frame of at most
+    `max_bytes`, waiting up to `max_delay` for company. The receiver has to split such frames, so it is off
+    unless `max_bytes` is non-zero.
+    */
+    virtual void SetCoalescing(size_t max_bytes, std::chrono::microseconds max_delay, const std::string& separator = "\n") = 0;
+    /** Messages written afterwards go out as binary frames (e.g. MessageCodec output) instead of text.
+    Kept across reconnects.
+    */
+    virtual void SetBinary(bool binary) = 0;
+    virtual bool IsBinary() const = 0;
+    virtual void AsyncPing(const std::string& data, CompletionHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    virtual void AsyncRead(ReadHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+
+    /** Full-duplex mode: keeps an `async_read` permanently outstanding and pushes every message into a bounded
+    lock-free queue of `capacity` entries (or hands it to `handler` on the socket's strand, if given; the handler
+    then also receives the error that ends the loop). Writes may be issued meanwhile from any thread.
+    While the loop runs, `Read` and `PopMessage` consume the queue. Requires an externally driven loop.
+    */
+    virtual bool StartReadLoop(size_t capacity = 4096, ReadHandler handler = nullptr) = 0;
+    /** The loop stops after the currently outstanding read completes.
+    */
+    virtual void StopReadLoop() = 0;
+    virtual bool IsReadLoopRunning() const = 0;
+    /** Non-blocking; must be called from one consumer thread at a time.
+    */
+    virtual bool PopMessage(std::string& ret) = 0;
+
+    /** Zero-copy reads: the view points straight into the receive buffer. Only one view can be outstanding
+    per socket; further reads fail with `already_started` until it is released. Not available while the
+    read loop runs.
+    */
+    virtual bool Read(MessageView& view, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    virtual void AsyncReadView(ViewHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+
+    /** View reads that come back already split at `splitter`'s delimiters; the fields point into `view`,
+    so keep it until they are parsed.
+    */
+    bool ReadFields(MessageView& view, FieldList& fields, const FieldSplitter& splitter, std::chrono::milliseconds timeout = DefaultTimeout)
+    {
+        fields.clear();
+        if (!Read(view, timeout))
+        {
+            return false;
+        }
+        splitter.Split(view.View(), fields);
+        return true;
+    }
+
+    void AsyncReadFields(const FieldSplitter& splitter, FieldsHandler handler, std::chrono::milliseconds timeout = DefaultTimeout)
+    {
+        AsyncReadView([self = shared_from_this(), splitter, handler = std::move(handler)](boost::system::error_code ec, MessageView view)
+            {
+                if (ec)
+                {
+                    handler(ec, std::move(view), FieldList());
+                    return;
+                }
+                splitter.Split(view.View(), self->_fields);
+                handler(ec, std::move(view), self->_fields);
+            }, timeout);
+    }
+
+    /** Streaming reads: the next message is handed to `handler` chunk by chunk (up to `chunk_size` bytes each)
+    as it arrives, so it is never buffered whole and may be larger than the connection's message limit.
+    `timeout` applies to every chunk. Same restrictions as views; the blocking form returns after the last chunk.
+    */
+    virtual bool ReadStream(ChunkHandler handler, size_t chunk_size = 65536, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+    virtual void AsyncReadStream(ChunkHandler handler, size_t chunk_size = 65536, std::chrono::milliseconds timeout = DefaultTimeout) = 0;
+
+    /** Pings the peer every interval on the socket's strand and times the pongs. Pongs are only seen while a
+    read is outstanding, so it needs the read loop: false if the loop isn't running, and pings pause whenever
+    it stops. After `max_missed` unanswered pings the connection is closed (so the read loop ends) and
+    `on_dead` gets `timed_out`. Survives reconnects.
+    */
+    virtual bool StartHeartbeat(const HeartbeatOptions& options, CompletionHandler on_dead = nullptr) = 0;
+    virtual void StopHeartbeat() = 0;
+    /** Round-trip times in nanoseconds over the last `rtt_window`. Any thread.
+    */
+    virtual Histogram RttHistogram() = 0;
+    virtual std::chrono::nanoseconds LastRtt() const = 0;
+
+protected:
+
+    /*Called once per view when its holder releases it.*/
+    virtual void ReleaseView() = 0;
 };
 
+inline void MessageView::Release()
+{
+    if (_owner)
+    {
+        auto owner = std::move(_owner);
+        _owner = nullptr;
+        _data = {};
+        owner->ReleaseView();
+    }
+}
+
 #endif //SOCKET_H__
 
@@ -0,0 +1,346 @@
+#ifndef SOCKETSTATS_H__
+#define SOCKETSTATS_H__
+
+#include <boost/system/error_code.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*Phases of establishing a connection, in the order they happen. TlsHandshake stays empty for plain sockets.*/
+enum class ConnectPhase
+{
+    Resolve,
+    TcpConnect,
+    TlsHandshake,
+    WsUpgrade,
+    Count
+};
+
+inline const char* ConnectPhaseName(ConnectPhase phase)
+{
+    switch (phase)
+    {
+    case ConnectPhase::Resolve: return "resolve";
+    case ConnectPhase::TcpConnect: return "tcp_connect";
+    case ConnectPhase::TlsHandshake: return "tls_handshake";
+    case ConnectPhase::WsUpgrade: return "ws_upgrade";
+    default: return "";
+    }
+}
+
+struct PhaseTiming
+{
+    std::chrono::nanoseconds last{ 0 };
+    std::chrono::nanoseconds total{ 0 };
+    std::chrono::nanoseconds max{ 0 };
+    uint64_t count = 0;
+
+    std::chrono::nanoseconds Mean() const
+    {
+        return count ? total / static_cast<int64_t>(count) : std::chrono::nanoseconds(0);
+    }
+
+    /*`last` of a merged timing is the larger of the two, it has no order to go by.*/
+    void Merge(const PhaseTiming& other)
+    {
+        last = (std::max)(last, other.last);
+        total += other.total;
+        max = (std::max)(max, other.max);
+        count += other.count;
+    }
+};
+
+/*Point-in-time copy of a socket's counters (or of the sum over many sockets).
+Timings are measured with the monotonic clock; bytes are message payload, without websocket framing.*/
+struct SocketStats
+{
+    PhaseTiming phases[static_cast<size_t>(ConnectPhase::Count)];
+    PhaseTiming connect;                        //whole successful connect, resolve to upgrade
+    PhaseTiming tls_resumed;                    //the TLS handshakes that resumed a session, also counted in the phase
+    uint64_t connects = 0;
+    uint64_t connect_failures = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t messages_sent = 0;
+    uint64_t messages_received = 0;
+    uint64_t wire_bytes_sent = 0;               //what the transport moved: framing, compression and TLS included
+    uint64_t wire_bytes_received = 0;
+    uint64_t errors = 0;
+    boost::system::error_code last_error;
+    std::chrono::steady_clock::time_point last_error_time;
+    uint64_t sockets = 0;                       //how many sockets contributed
+
+    const PhaseTiming& Phase(ConnectPhase phase) const
+    {
+        return phases[static_cast<size_t>(phase)];
+    }
+
+    /*Payload bytes per wire byte; above 1 when compression pays off.*/
+    double SendRatio() const
+    {
+        return wire_bytes_sent ? static_cast<double>(bytes_sent) / wire_bytes_sent : 0.0;
+    }
+
+    double ReceiveRatio() const
+    {
+        return wire_bytes_received ? static_cast<double>(bytes_received) / wire_bytes_received : 0.0;
+    }
+
+    void Merge(const SocketStats& other)
+    {
+        for (size_t i = 0; i < static_cast<size_t>(ConnectPhase::Count); ++i)
+        {
+            phases[i].Merge(other.phases[i]);
+        }
+        connect.Merge(other.connect);
+        tls_resumed.Merge(other.tls_resumed);
+        connects += other.connects;
+        connect_failures += other.connect_failures;
+        bytes_sent += other.bytes_sent;
+        bytes_received += other.bytes_received;
+        messages_sent += other.messages_sent;
+        messages_received += other.messages_received;
+        wire_bytes_sent += other.wire_bytes_sent;
+        wire_bytes_received += other.wire_bytes_received;
+        errors += other.errors;
+        if (other.errors && other.last_error_time >= last_error_time)
+        {
+            last_error = other.last_error;
+            last_error_time = other.last_error_time;
+        }
+        sockets += other.sockets;
+    }
+};
+
+
+class SocketStatsRegistry;
+
+/*The live counters behind SocketStats. Written from the socket's strand, readable from any thread:
+the hot-path counters are relaxed atomics, the error (rare) sits behind a mutex.*/
+class SocketCounters
+{
+    friend class SocketStatsRegistry;
+
+protected:
+
+    struct Timing
+    {
+        std::atomic<int64_t> last{ 0 }, total{ 0 }, max{ 0 };
+        std::atomic<uint64_t> count{ 0 };
+
+        void Record(int64_t ns)
+        {
+            last.store(ns, std::memory_order_relaxed);
+            total.fetch_add(ns, std::memory_order_relaxed);
+            if (ns > max.load(std::memory_order_relaxed))
+            {
+                max.store(ns, std::memory_order_relaxed);
+            }
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        PhaseTiming Load() const
+        {
+            PhaseTiming ret;
+            ret.last = std::chrono::nanoseconds(last.load(std::memory_order_relaxed));
+            ret.total = std::chrono::nanoseconds(total.load(std::memory_order_relaxed));
+            ret.max = std::chrono::nanoseconds(max.load(std::memory_order_relaxed));
+            ret.count = count.load(std::memory_order_relaxed);
+            return ret;
+        }
+    };
+
+    Timing _phases[static_cast<size_t>(ConnectPhase::Count)];
+    Timing _connect;
+    Timing _tls_resumed;
+    std::atomic<uint64_t> _connects{ 0 }, _connect_failures{ 0 };
+    std::atomic<uint64_t> _bytes_sent{ 0 }, _bytes_received{ 0 }, _messages_sent{ 0 }, _messages_received{ 0 };
+    std::atomic<uint64_t> _wire_sent{ 0 }, _wire_received{ 0 };
+    std::atomic<uint64_t> _errors{ 0 };
+    mutable std::mutex _error_mutex;
+    boost::system::error_code _last_error;
+    std::chrono::steady_clock::time_point _last_error_time;
+
+    //strand only
+    std::chrono::steady_clock::time_point _connect_start, _phase_start;
+
+    std::shared_ptr<SocketStatsRegistry> _registry;
+
+public:
+
+    SocketCounters() {}
+
+    SocketCounters(const SocketCounters&) = delete;
+    SocketCounters& operator=(const SocketCounters&) = delete;
+
+    inline ~SocketCounters();
+
+    /*Makes the counters part of the registry's aggregate until they are destroyed.*/
+    inline void AttachTo(std::shared_ptr<SocketStatsRegistry> registry);
+
+    void ConnectStarted()
+    {
+        _connect_start = _phase_start = std::chrono::steady_clock::now();
+    }
+
+    /*Closes the phase that started when the previous one ended.*/
+    void PhaseDone(ConnectPhase phase, bool resumed = false)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _phase_start).count();
+        _phases[static_cast<size_t>(phase)].Record(ns);
+        if (resumed)
+        {
+            _tls_resumed.Record(ns);
+        }
+        _phase_start = now;
+    }
+
+    void ConnectDone(const boost::system::error_code& ec)
+    {
+        if (ec)
+        {
+            _connect_failures.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        _connect.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _connect_start).count());
+        _connects.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Sent(size_t bytes, size_t messages = 1)
+    {
+        _bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+        _messages_sent.fetch_add(messages, std::memory_order_relaxed);
+    }
+
+    void Received(size_t bytes)
+    {
+        _bytes_received.fetch_add(bytes, std::memory_order_relaxed);
+        _messages_received.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void WireSent(size_t bytes)
+    {
+        _wire_sent.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void WireReceived(size_t bytes)
+    {
+        _wire_received.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    uint64_t WireBytesReceived() const
+    {
+        return _wire_received.load(std::memory_order_relaxed);
+    }
+
+    void Error(const boost::system::error_code& ec)
+    {
+        _errors.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(_error_mutex);
+        _last_error = ec;
+        _last_error_time = std::chrono::steady_clock::now();
+    }
+
+    SocketStats Snapshot() const
+    {
+        SocketStats ret;
+        for (size_t i = 0; i < static_cast<size_t>(ConnectPhase::Count); ++i)
+        {
+            ret.phases[i] = _phases[i].Load();
+        }
+        ret.connect = _connect.Load();
+        ret.tls_resumed = _tls_resumed.Load();
+        ret.connects = _connects.load(std::memory_order_relaxed);
+        ret.connect_failures = _connect_failures.load(std::memory_order_relaxed);
+        ret.bytes_sent = _bytes_sent.load(std::memory_order_relaxed);
+        ret.bytes_received = _bytes_received.load(std::memory_order_relaxed);
+        ret.messages_sent = _messages_sent.load(std::memory_order_relaxed);
+        ret.messages_received = _messages_received.load(std::memory_order_relaxed);
+        ret.wire_bytes_sent = _wire_sent.load(std::memory_order_relaxed);
+        ret.wire_bytes_received = _wire_received.load(std::memory_order_relaxed);
+        ret.errors = _errors.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_error_mutex);
+            ret.last_error = _last_error;
+            ret.last_error_time = _last_error_time;
+        }
+        ret.sockets = 1;
+        return ret;
+    }
+};
+
+
+/*Process-wide view over many sockets. Costs nothing per message: live sockets are summed when the aggregate
+is asked for, and a socket's final numbers are folded into a running total when it is destroyed.*/
+class SocketStatsRegistry
+{
+protected:
+
+    std::mutex _mutex;
+    std::vector<const SocketCounters*> _live;
+    SocketStats _retired;
+
+public:
+
+    void Attach(const SocketCounters* counters)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _live.push_back(counters);
+    }
+
+    void Detach(const SocketCounters* counters)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = std::find(_live.begin(), _live.end(), counters);
+        if (it == _live.end())
+        {
+            return;
+        }
+        *it = _live.back();
+        _live.pop_back();
+        _retired.Merge(counters->Snapshot());
+    }
+
+    /*Sum over every socket ever attached; `sockets` counts them, `live` (if given) gets the ones still alive.*/
+    SocketStats Aggregate(size_t* live = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto ret = _retired;
+        for (auto counters : _live)
+        {
+            ret.Merge(counters->Snapshot());
+        }
+        if (live)
+        {
+            *live = _live.size();
+        }
+        return ret;
+    }
+};
+
+inline SocketCounters::~SocketCounters()
+{
+    if (_registry)
+    {
+        _registry->Detach(this);
+    }
+}
+
+inline void SocketCounters::AttachTo(std::shared_ptr<SocketStatsRegistry> registry)
+{
+    if (_registry)
+    {
+        _registry->Detach(this);
+    }
+    _registry = std::move(registry);
+    if (_registry)
+    {
+        _registry->Attach(this);
+    }
+}
+
+#endif //SOCKETSTATS_H__
@@ -0,0 +1,154 @@
+#ifndef TLSCONTEXT_H__
+#define TLSCONTEXT_H__
+
+#include <boost/asio/ssl.hpp>
+#include <openssl/ssl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct TlsOptions
+{
+    bool verify_peer = false;               //check the chain and the host name
+    std::string ca_file;                    //PEM bundle; empty - the system's default paths
+    int min_version = TLS1_2_VERSION;
+    int max_version = 0;                    //0 - the highest OpenSSL supports
+    std::string ciphers;                    //TLS 1.2 and below, OpenSSL cipher list syntax; empty - library default
+    std::string ciphersuites;               //TLS 1.3; empty - library default
+    bool resume_sessions = true;
+};
+
+/*Client TLS context shared by many sockets, plus a cache of the last session per "host:port".
+Sessions are collected through OpenSSL's new-session callback, so both TLS 1.2 tickets/session ids and
+TLS 1.3 tickets (which arrive after the handshake) are picked up. Thread-safe.*/
+class TlsClientContext
+{
+protected:
+
+    boost::asio::ssl::context _ctx;
+    TlsOptions _opt;
+    std::mutex _mutex;
+    std::unordered_map<std::string, SSL_SESSION*> _sessions;
+
+    static int ContextIndex()
+    {
+        static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    static int KeyIndex()
+    {
+        static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    static int OnNewSession(SSL* ssl, SSL_SESSION* session)
+    {
+        auto self = static_cast<TlsClientContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ContextIndex()));
+        auto key = static_cast<const std::string*>(SSL_get_ex_data(ssl, KeyIndex()));
+        if (!self || !key)
+        {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lock(self->_mutex);
+        auto& slot = self->_sessions[*key];
+        if (slot)
+        {
+            SSL_SESSION_free(slot);
+        }
+        slot = session;
+        return 1;   //we keep the reference
+    }
+
+public:
+
+    explicit TlsClientContext(TlsOptions opt = TlsOptions()) : _ctx(boost::asio::ssl::context::tls_client), _opt(std::move(opt))
+    {
+        auto native = _ctx.native_handle();
+        SSL_CTX_set_min_proto_version(native, _opt.min_version);
+        if (_opt.max_version)
+        {
+            SSL_CTX_set_max_proto_version(native, _opt.max_version);
+        }
+        if (!_opt.ciphers.empty())
+        {
+            SSL_CTX_set_cipher_list(native, _opt.ciphers.c_str());
+        }
+        if (!_opt.ciphersuites.empty())
+        {
+            SSL_CTX_set_ciphersuites(native, _opt.ciphersuites.c_str());
+        }
+        boost::system::error_code ec;
+        if (_opt.verify_peer)
+        {
+            if (_opt.ca_file.empty())
+            {
+                _ctx.set_default_verify_paths(ec);
+            }
+            else
+            {
+                _ctx.load_verify_file(_opt.ca_file, ec);
+            }
+            _ctx.set_verify_mode(boost::asio::ssl::verify_peer, ec);
+        }
+        else
+        {
+            _ctx.set_verify_mode(boost::asio::ssl::verify_none, ec);
+        }
+        if (_opt.resume_sessions)
+        {
+            SSL_CTX_set_ex_data(native, ContextIndex(), this);
+            SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(native, &TlsClientContext::OnNewSession);
+        }
+    }
+
+    TlsClientContext(const TlsClientContext&) = delete;
+    TlsClientContext& operator=(const TlsClientContext&) = delete;
+
+    boost::asio::ssl::context& Context()
+    {
+        return _ctx;
+    }
+
+    const TlsOptions& Options() const
+    {
+        return _opt;
+    }
+
+    /*Call before the handshake: offers the cached session for `key` and files the sessions the server
+    hands out under it. `key` must outlive `ssl`.*/
+    void Prepare(SSL* ssl, const std::string* key)
+    {
+        if (!_opt.resume_sessions)
+        {
+            return;
+        }
+        SSL_set_ex_data(ssl, KeyIndex(), const_cast<std::string*>(key));
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _sessions.find(*key);
+        if (it != _sessions.end() && SSL_SESSION_is_resumable(it->second))
+        {
+            SSL_set_session(ssl, it->second);
+        }
+    }
+
+    /*E.g. after the server's certificate changed.*/
+    void ForgetSessions()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& entry : _sessions)
+        {
+            SSL_SESSION_free(entry.second);
+        }
+        _sessions.clear();
+    }
+
+    virtual ~TlsClientContext()
+    {
+        ForgetSessions();
+    }
+};
+
+#endif //TLSCONTEXT_H__
@@ -2,6 +2,11 @@
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <ctime>
+#include "Journal.hpp"
 
 // thread-safe generator
 int intRand(const int& min, const int& max) {
@@ -52,38 +57,40 @@ public:
 	static void log(const std::string& msg);
 	static void log(const std::vector<std::string>& vMsg);
 	static void initializeLog();
+	static void flush();
 private:
-	static void writeLog(const std::string& filename, const std::string& msg);
+	static Journal& journal();
 };
 
 std::string clientLog = "Client_requests_responses.csv";
 
+inline Journal& Logger::journal()
+{
+	static Journal journal([]() {
+		Journal::Options opt;
+		opt.path = clientLog;
+		return opt;
+	}());
+	return journal;
+}
+
 inline void Logger::initializeLog()
 {
-	if (!std::filesystem::exists(clientLog)) {
-		const std::string first_mes_event = "#time,request,response\n";
-		write_to_file(first_mes_event, clientLog, std::ios_base::app);
-	}
+	journal().Open();
 	return;
 }
 
 inline void Logger::log(const std::string& msg)
 {
-	Logger::writeLog(clientLog, msg);
+	journal().AppendRaw(msg);
 }
 
 inline void Logger::log(const std::vector<std::string>& vMsg)
 {
-	const auto str = encodeStr(vMsg, ",");
-	Logger::log(str);
+	journal().Append(vMsg);
 }
 
-inline void Logger::writeLog(const std::string& filename, const std::string& msg)
+inline void Logger::flush()
 {
-	std::stringstream message;
-	message << boost::posix_time::to_simple_string(boost::posix_time::second_clock::universal_time())
-		<< "," << msg << std::endl;
-
-	write_to_file(message.str(), filename, std::ios_base::app);
+	journal().Flush();
 }
-
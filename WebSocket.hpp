@@ -2,19 +2,360 @@
 #define WEBSOCKET_H__
 
 #include "Socket.hpp"
+#include "HandlerAllocator.hpp"
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/circular_buffer.hpp>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <thread>
 
-template<typename T> class WebSocketBase :public ISocket
+/*Rate policy that limits nothing and counts the bytes the transport actually moves.*/
+class WireCounter
 {
+    friend class beast::rate_policy_access;
+
+    SocketCounters* _counters = nullptr;
+
+    std::size_t available_read_bytes() const noexcept
+    {
+        return (std::numeric_limits<std::size_t>::max)();
+    }
+
+    std::size_t available_write_bytes() const noexcept
+    {
+        return (std::numeric_limits<std::size_t>::max)();
+    }
+
+    void transfer_read_bytes(std::size_t n) noexcept
+    {
+        if (_counters)
+        {
+            _counters->WireReceived(n);
+        }
+    }
+
+    void transfer_write_bytes(std::size_t n) noexcept
+    {
+        if (_counters)
+        {
+            _counters->WireSent(n);
+        }
+    }
+
+    void on_timer() const noexcept
+    {
+    }
+
+public:
+
+    void Attach(SocketCounters* counters)
+    {
+        _counters = counters;
+    }
+};
+
+/*A tcp_stream whose executor type is the strand itself. beast::tcp_stream erases it into any_io_executor,
+which heap-allocates a copy of the strand every time Beast or Asio re-wraps the executor - several times
+per operation.*/
+using strand_tcp_stream = beast::basic_stream<tcp, net::strand<net::io_context::executor_type>, WireCounter>;
+
+/*Timers bound to the strand's own executor type: an any_io_executor timer re-wraps the strand on the heap for
+every wait, which per-message deadlines can't afford.*/
+using StrandTimer = net::basic_waitable_timer<std::chrono::steady_clock, net::wait_traits<std::chrono::steady_clock>,
+    net::strand<net::io_context::executor_type>>;
+
+/*permessage_deflate::msg_size_threshold only exists in newer Beast versions.*/
+template<typename Options, typename = void>
+struct HasSizeThreshold : std::false_type {};
+
+template<typename Options>
+struct HasSizeThreshold<Options, std::void_t<decltype(std::declval<Options&>().msg_size_threshold)>> : std::true_type {};
+
+using ClientStrand = net::strand<net::io_context::executor_type>;
+
+/*Transport policies for ConnectChain: how a connection's websocket stream is made and what its layer needs
+between the TCP connect and the upgrade.*/
+struct PlainTransport
+{
+    using Layer = strand_tcp_stream;
+
+    std::unique_ptr<websocket::stream<Layer>> Make(const ClientStrand& strand)
+    {
+        return std::make_unique<websocket::stream<Layer>>(strand);
+    }
+
+    template<typename Handler>
+    void Handshake(websocket::stream<Layer>&, const std::string&, const std::string&, Handler&& handler)
+    {
+        handler(boost::system::error_code());
+    }
+};
+
+/*TLS with SNI. From a TlsClientContext also peer verification and session resumption (share the factory's one to
+resume sessions across all connections); a bare ssl::context is used as it is.*/
+class TlsTransport
+{
+protected:
+
+    std::shared_ptr<TlsClientContext> _tls;
+    std::shared_ptr<ssl::context> _ctx;
+    std::string _session_key;
+
+public:
+
+    using Layer = ssl::stream<strand_tcp_stream>;
+
+    TlsTransport() : _tls(std::make_shared<TlsClientContext>())
+    {
+    }
+
+    explicit TlsTransport(std::shared_ptr<TlsClientContext> tls) : _tls(std::move(tls))
+    {
+    }
+
+    explicit TlsTransport(ssl::context ctx) : _ctx(std::make_shared<ssl::context>(std::move(ctx)))
+    {
+    }
+
+    std::unique_ptr<websocket::stream<Layer>> Make(const ClientStrand& strand)
+    {
+        return std::make_unique<websocket::stream<Layer>>(strand, _tls ? _tls->Context() : *_ctx);
+    }
+
+    template<typename Handler>
+    void Handshake(websocket::stream<Layer>& ws, const std::string& host, const std::string& port, Handler&& handler)
+    {
+        if (!SSL_set_tlsext_host_name(ws.next_layer().native_handle(), host.c_str()))
+        {
+            handler(boost::system::error_code{ static_cast<int>(::ERR_get_error()), net::error::get_ssl_category() });
+            return;
+        }
+        if (_tls)
+        {
+            if (_tls->Options().verify_peer)
+            {
+                ws.next_layer().set_verify_callback(ssl::host_name_verification(host));
+            }
+            _session_key = host + ":" + port;
+            _tls->Prepare(ws.next_layer().native_handle(), &_session_key);
+        }
+        ws.next_layer().async_handshake(ssl::stream_base::client, std::forward<Handler>(handler));
+    }
+};
+
+/*The connect sequence of WebSocketBase and FastClient: resolve (through the cache when there is one), TCP connect,
+the transport's handshake and the websocket upgrade, all within one deadline and timed into the owner's counters.
+Every attempt gets a fresh stream from the transport. The chain belongs to the owner of the stream and the counters,
+and `done` has to keep that owner alive.*/
+template<typename Transport>
+class ConnectChain
+{
+public:
+
+    using Stream = websocket::stream<typename Transport::Layer>;
+
 protected:
+
+    std::unique_ptr<Stream>& _ws;
+    SocketCounters& _stats;
+    ClientStrand _strand;
+    Transport _transport;
+    std::unique_ptr<tcp::resolver> _resolver;
+    std::shared_ptr<ResolverCache> _cache;
+    std::string _host, _port, _path;
+    std::chrono::steady_clock::time_point _deadline;
+    websocket::stream_base::timeout _upgrade;
+
+public:
+
+    ConnectChain(std::unique_ptr<Stream>& ws, SocketCounters& stats, const ClientStrand& strand, Transport transport)
+        : _ws(ws), _stats(stats), _strand(strand), _transport(std::move(transport))
+    {
+    }
+
+    ConnectChain(const ConnectChain&) = delete;
+    ConnectChain& operator=(const ConnectChain&) = delete;
+
+    /** `prepare(Stream&)` configures each new stream before it connects. `upgrade` are the stream's options for the
+    upgrade, whose handshake timeout is cut to what is left until `deadline`. `done(error_code, ConnectPhase)` is
+    called once, with the phase that failed (Count on success).
+    */
+    template<typename Prepare, typename Done>
+    void Start(std::shared_ptr<ResolverCache> cache, const std::string& host, const std::string& port, const std::string& path,
+        std::chrono::steady_clock::time_point deadline, const websocket::stream_base::timeout& upgrade, Prepare prepare, Done done)
+    {
+        _cache = std::move(cache);
+        _host = host;
+        _port = port;
+        _path = path;
+        _deadline = deadline;
+        _upgrade = upgrade;
+        _stats.ConnectStarted();
+        auto resolved = [this, prepare = std::move(prepare), done = std::move(done)](boost::system::error_code ec, tcp::resolver::results_type results) mutable
+            {
+                OnResolve(ec, std::move(results), std::move(prepare), std::move(done));
+            };
+        if (_cache)
+        {
+            _cache->AsyncResolve(_host, _port, _strand, std::move(resolved));
+            return;
+        }
+        _resolver = std::make_unique<tcp::resolver>(_strand);
+        _resolver->async_resolve(_host, _port, std::move(resolved));
+    }
+
+    /** On the strand: aborts a lookup of the chain's own resolver (a cached lookup is shared and runs on).
+    */
+    void Cancel()
+    {
+        if (_resolver)
+        {
+            _resolver->cancel();
+        }
+    }
+
+protected:
+
+    template<typename Prepare, typename Done>
+    void OnResolve(boost::system::error_code ec, tcp::resolver::results_type results, Prepare prepare, Done done)
+    {
+        if (ec)
+        {
+            done(ec, ConnectPhase::Resolve);
+            return;
+        }
+        _stats.PhaseDone(ConnectPhase::Resolve);
+        _ws = _transport.Make(_strand);
+        beast::get_lowest_layer(*_ws).rate_policy().Attach(&_stats);
+        prepare(*_ws);
+        //the transport's handshake runs under the same expiry as the TCP connect
+        beast::get_lowest_layer(*_ws).expires_at(_deadline);
+        beast::get_lowest_layer(*_ws).async_connect(results, [this, done = std::move(done)](boost::system::error_code ec, const tcp::endpoint&) mutable
+            {
+                if (ec)
+                {
+                    if (_cache)
+                    {
+                        //the addresses may have moved, look them up again next time
+                        _cache->MarkStale(_host, _port);
+                    }
+                    done(ec, ConnectPhase::TcpConnect);
+                    return;
+                }
+                _stats.PhaseDone(ConnectPhase::TcpConnect);
+                _transport.Handshake(*_ws, _host, _port, [this, done = std::move(done)](boost::system::error_code ec) mutable
+                    {
+                        OnTransport(ec, std::move(done));
+                    });
+            });
+    }
+
+    template<typename Done>
+    void OnTransport(boost::system::error_code ec, Done done)
+    {
+        if (ec)
+        {
+            beast::get_lowest_layer(*_ws).close();
+            done(ec, ConnectPhase::TlsHandshake);
+            return;
+        }
+        if constexpr (std::is_same<typename Transport::Layer, ssl::stream<strand_tcp_stream>>::value)
+        {
+            _stats.PhaseDone(ConnectPhase::TlsHandshake, SSL_session_reused(_ws->next_layer().native_handle()) == 1);
+        }
+        //the websocket stream keeps its own timeouts from here on
+        beast::get_lowest_layer(*_ws).expires_never();
+        auto upgrade = _upgrade;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - std::chrono::steady_clock::now());
+        upgrade.handshake_timeout = (std::min)(std::chrono::steady_clock::duration(_upgrade.handshake_timeout),
+            std::chrono::steady_clock::duration((std::max)(left, std::chrono::milliseconds(1))));
+        _ws->set_option(upgrade);
+        _ws->async_handshake(_host + ":" + _port, _path, [this, done = std::move(done)](boost::system::error_code ec) mutable
+            {
+                if (ec)
+                {
+                    done(ec, ConnectPhase::WsUpgrade);
+                    return;
+                }
+                _stats.PhaseDone(ConnectPhase::WsUpgrade);
+                done(ec, ConnectPhase::Count);
+            });
+    }
+};
+
+template<typename Transport> class WebSocketBase :public ISocket
+{
+protected:
+    HandlerArena _arena;        //first: outlives the stream whose operations it backs
     bool is_connected = false;
-    std::unique_ptr<websocket::stream<T>> ws;
+    std::unique_ptr<typename ConnectChain<Transport>::Stream> ws;
     std::string _domen, _port, _path, url;
     net::io_context& ioc;
-    beast::flat_buffer _buffer;
+    ClientStrand _strand;
+    ConnectChain<Transport> _chain;
+    using ReceiveBuffer = beast::basic_flat_buffer<PoolAllocator<char>>;
+    ReceiveBuffer _buffer;
+    size_t _message_max = 1ull << 26;
+    size_t _retain_bytes = (std::numeric_limits<size_t>::max)();
     websocket::stream_base::timeout opt;
-    std::promise<bool> success_ret;
+    CompletionHandler _connect_handler;
     std::shared_ptr<ILogger> _logger;
 
+    std::unique_ptr<boost::lockfree::spsc_queue<std::string>> _inbound;
+    size_t _inbound_capacity = 0;
+    std::atomic<bool> _read_loop{ false };
+    std::atomic<bool> _view_out{ false };     //also set while a streaming read is in progress
+    uint64_t _stream_bytes = 0;
+    std::atomic<bool> _binary{ false };
+    std::string _stream_tail;
+    ReadHandler _loop_handler;
+    std::string _stalled;
+    std::unique_ptr<StrandTimer> _stall_timer;
+
+    struct Outbound
+    {
+        std::string owned;
+        std::vector<net::const_buffer> buffers;
+        net::const_buffer single;               //AsyncWrite of one string: the caller's bytes, no vector
+        CompletionHandler handler;
+        std::chrono::steady_clock::time_point queued;
+        std::chrono::steady_clock::time_point deadline;
+        bool is_owned = false;
+        bool is_single = false;
+    };
+    using OutboundQueue = boost::circular_buffer<Outbound>;
+    std::mutex _out_mutex;
+    OutboundQueue _outbound{ 64 };              //grows to the deepest backlog seen, then is reused
+    bool _write_active = false;
+    Outbound _current;
+    size_t _write_count = 0;
+    std::unique_ptr<StrandTimer> _write_timer;
+    bool _write_expired = false;
+    std::chrono::steady_clock::time_point _connect_deadline;
+    std::string _batch;
+    std::vector<CompletionHandler> _batch_handlers, _done_handlers;
+    size_t _coalesce_bytes = 0;
+    std::chrono::microseconds _coalesce_delay{ 0 };
+    std::string _coalesce_separator = "\n";
+    std::unique_ptr<StrandTimer> _coalesce_timer;
+    std::unique_ptr<StrandTimer> _idle_timer;
+    uint64_t _idle_seen = 0;                    //wire bytes received at the last idle check
+    bool _idle_pinged = false;
+    bool _idle_expired = false;                 //the watchdog closed the connection
+
+    HeartbeatOptions _hb;
+    CompletionHandler _hb_dead;
+    std::unique_ptr<StrandTimer> _hb_timer;
+    bool _hb_running = false;
+    bool _hb_waiting = false;
+    unsigned _hb_missed = 0;
+    uint64_t _hb_seq = 0;
+    std::chrono::steady_clock::time_point _hb_sent;
+    std::mutex _rtt_mutex;
+    std::unique_ptr<RollingHistogram> _rtt;
+    std::atomic<int64_t> _last_rtt{ 0 };
+
 public:
 
     virtual size_t AvailableBytes() override
@@ -38,367 +379,1475 @@ public:
         _path = path;
         url = domen + ":" + port + path;
 
-        return ReConnect();
+        return ReConnect();
+    }
+
+    virtual bool ReConnect() override
+    {
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.ReConnect", [&](auto notify)
+            {
+                AsyncReConnect([&ec, notify](boost::system::error_code e) { ec = e; notify(); });
+            });
+        return started && !ec && is_connected;
+    }
+
+    virtual bool Write(const std::string& data, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen())
+        {
+            _err = "Trying to write message while not connected";
+            _logger->LogError("WebSocket.Write", _err);
+            return false;
+        }
+
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.Write", [&](auto notify)
+            {
+                AsyncWrite(data, [&ec, notify](boost::system::error_code e) { ec = e; notify(); }, timeout);
+            });
+        return started && !ec;
+    }
+
+    virtual bool Write(const std::vector<net::const_buffer>& buffers, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen())
+        {
+            _err = "Trying to write message while not connected";
+            _logger->LogError("WebSocket.Write", _err);
+            return false;
+        }
+
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.Write", [&](auto notify)
+            {
+                AsyncWrite(buffers, [&ec, notify](boost::system::error_code e) { ec = e; notify(); }, timeout);
+            });
+        return started && !ec;
+    }
+
+    virtual bool Ping(const std::string& data = "", std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen())
+        {
+            _err = "Trying to write message while not connected";
+            _logger->LogError("WebSocket.Ping", _err);
+            return false;
+        }
+
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.Ping", [&](auto notify)
+            {
+                AsyncPing(data, [&ec, notify](boost::system::error_code e) { ec = e; notify(); }, timeout);
+            });
+        return started && !ec;
+    }
+
+    bool Read(std::string& ask, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (_inbound && (_read_loop || _inbound->read_available()))
+        {
+            return WaitInbound(ask, timeout);
+        }
+        if (!IsOpen())
+        {
+            _err = "Trying to read message while not connected";
+            _logger->LogError("WebSocket.Read", _err);
+            ask = "";
+            return false;
+        }
+
+        boost::system::error_code ec;
+        std::string ret;
+        auto started = Await("WebSocket.Read", [&](auto notify)
+            {
+                AsyncRead([&ec, &ret, notify](boost::system::error_code e, std::string msg) { ec = e; ret = std::move(msg); notify(); }, timeout);
+            });
+        ask = std::move(ret);
+        return started && !ec;
+    }
+
+    virtual bool Read(MessageView& view, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        view.Release();
+        if (!IsOpen())
+        {
+            _err = "Trying to read message while not connected";
+            _logger->LogError("WebSocket.Read", _err);
+            return false;
+        }
+
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.Read", [&](auto notify)
+            {
+                AsyncReadView([&ec, &view, notify](boost::system::error_code e, MessageView msg) { ec = e; view = std::move(msg); notify(); }, timeout);
+            });
+        return started && !ec;
+    }
+
+    virtual bool ReadStream(ChunkHandler handler, size_t chunk_size = 65536, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen())
+        {
+            _err = "Trying to read message while not connected";
+            _logger->LogError("WebSocket.ReadStream", _err);
+            return false;
+        }
+
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.ReadStream", [&](auto notify)
+            {
+                AsyncReadStream([&ec, &handler, notify](boost::system::error_code e, std::string_view chunk, bool done)
+                    {
+                        handler(e, chunk, done);
+                        if (done)
+                        {
+                            ec = e;
+                            notify();
+                        }
+                    }, chunk_size, timeout);
+            });
+        return started && !ec;
+    }
+
+    virtual net::any_io_executor GetExecutor() override
+    {
+        return _strand;
+    }
+
+    virtual bool IsOpen() override
+    {
+        return is_connected && ws.get() && ws->is_open() && beast::get_lowest_layer(*ws.get()).socket().is_open();
+    }
+
+    virtual bool Close() override
+    {
+        if (!ws)
+        {
+            return true;
+        }
+        boost::system::error_code ec;
+        auto started = Await("WebSocket.Close", [&](auto notify)
+            {
+                AsyncClose([&ec, notify](boost::system::error_code e) { ec = e; notify(); });
+            });
+        return started && !ec;
+    }
+
+    virtual void AsyncConnect(const std::string& address, const std::string& port, CompletionHandler handler) override
+    {
+        std::string prefix, path, uri_port, domen;
+        std::tie(prefix, domen, uri_port, path) = ParseURI(address);
+        _domen = domen;
+        _port = port;
+        _path = path;
+        url = domen + ":" + port + path;
+
+        AsyncReConnect(std::move(handler));
+    }
+
+    virtual void AsyncReConnect(CompletionHandler handler) override
+    {
+        net::dispatch(_strand, [self = Self(), handler = std::move(handler)]() mutable
+            {
+                self->_ec.clear();
+                self->_connect_handler = std::move(handler);
+                if (self->is_connected && self->ws && self->ws->is_open())
+                {
+                    self->is_connected = false;
+                    self->ws->async_close(websocket::close_code::normal, beast::bind_front_handler(&WebSocketBase<Transport>::OnReConnectClose, self));
+                    return;
+                }
+                self->is_connected = false;
+                self->Resolve();
+            });
+    }
+
+    virtual void AsyncClose(CompletionHandler handler) override
+    {
+        net::dispatch(_strand, [self = Self(), handler = std::move(handler)]() mutable
+            {
+                if (!self->ws)
+                {
+                    handler({});
+                    return;
+                }
+                self->ws->async_close(websocket::close_code::normal, beast::bind_front_handler(&WebSocketBase<Transport>::OnClose, self, std::move(handler)));
+            });
+    }
+
+    virtual void AsyncWrite(const std::string& data, CompletionHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        Outbound out;
+        out.single = net::buffer(data);
+        out.is_single = true;
+        out.handler = std::move(handler);
+        Push(std::move(out), timeout, "WebSocket.AsyncWrite");
+    }
+
+    virtual void AsyncWrite(std::vector<net::const_buffer> buffers, CompletionHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        Outbound out;
+        out.buffers = std::move(buffers);
+        out.handler = std::move(handler);
+        Push(std::move(out), timeout, "WebSocket.AsyncWrite");
+    }
+
+    virtual void Enqueue(std::string data, CompletionHandler handler = nullptr, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        Outbound out;
+        out.owned = std::move(data);
+        out.is_owned = true;
+        out.handler = std::move(handler);
+        Push(std::move(out), timeout, "WebSocket.Enqueue");
+    }
+
+    virtual void SetCoalescing(size_t max_bytes, std::chrono::microseconds max_delay, const std::string& separator = "\n") override
+    {
+        std::lock_guard<std::mutex> lock(_out_mutex);
+        _coalesce_bytes = max_bytes;
+        _coalesce_delay = max_delay;
+        _coalesce_separator = separator;
+    }
+
+    virtual void SetBinary(bool binary) override
+    {
+        _binary = binary;
+        net::dispatch(_strand, [self = Self(), binary]()
+            {
+                if (self->ws)
+                {
+                    self->ws->binary(binary);
+                }
+            });
+    }
+
+    virtual bool IsBinary() const override
+    {
+        return _binary;
+    }
+
+    virtual void AsyncPing(const std::string& data, CompletionHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen())
+        {
+            _err = "Trying to write message while not connected";
+            _logger->LogError("WebSocket.AsyncPing", _err);
+            Fail(std::move(handler), net::error::not_connected);
+            return;
+        }
+        net::dispatch(_strand, [self = Self(), payload = beast::websocket::ping_data(data), handler = std::move(handler), timeout]() mutable
+            {
+                self->_ec.clear();
+                auto deadline = self->ArmDeadline(timeout, "WebSocket.Ping");
+                self->ws->async_ping(payload, [self, handler = std::move(handler), deadline](boost::system::error_code ec) mutable
+                    {
+                        self->OnPing(std::move(handler), self->Disarm(deadline, ec));
+                    });
+            });
+    }
+
+    virtual void AsyncRead(ReadHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen())
+        {
+            _err = "Trying to read message while not connected";
+            _logger->LogError("WebSocket.AsyncRead", _err);
+            net::post(_strand, [handler = std::move(handler)]() { handler(net::error::not_connected, ""); });
+            return;
+        }
+        net::dispatch(_strand, Recycled([self = Self(), handler = std::move(handler), timeout]() mutable
+            {
+                if (self->_view_out)
+                {
+                    self->_err = "Trying to read message while a message view is still held";
+                    self->_logger->LogError("WebSocket.AsyncRead", self->_err);
+                    net::post(self->_strand, [handler = std::move(handler)]() { handler(net::error::already_started, ""); });
+                    return;
+                }
+                self->_ec.clear();
+                auto deadline = self->ArmDeadline(timeout, "WebSocket.Read");
+                self->ws->async_read(self->_buffer, self->Recycled([self, handler = std::move(handler), deadline](boost::system::error_code ec, std::size_t bytes) mutable
+                    {
+                        self->OnRead(std::move(handler), self->Disarm(deadline, ec), bytes);
+                    }));
+            }));
+    }
+
+    virtual void AsyncReadView(ViewHandler handler, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen() || _read_loop)
+        {
+            _err = _read_loop ? "Trying to read a message view while the read loop is running" : "Trying to read message while not connected";
+            _logger->LogError("WebSocket.AsyncReadView", _err);
+            auto ec = _read_loop ? net::error::operation_not_supported : net::error::not_connected;
+            net::post(_strand, [handler = std::move(handler), ec]() { handler(ec, MessageView()); });
+            return;
+        }
+        //checked on the strand, behind the release of a view dropped just before this call
+        net::dispatch(_strand, Recycled([self = Self(), handler = std::move(handler), timeout]() mutable
+            {
+                if (self->_view_out.exchange(true))
+                {
+                    self->_err = "Trying to read message while a message view is still held";
+                    self->_logger->LogError("WebSocket.AsyncReadView", self->_err);
+                    net::post(self->_strand, [handler = std::move(handler)]() { handler(net::error::already_started, MessageView()); });
+                    return;
+                }
+                self->_ec.clear();
+                auto deadline = self->ArmDeadline(timeout, "WebSocket.ReadView");
+                self->ws->async_read(self->_buffer, self->Recycled([self, handler = std::move(handler), deadline](boost::system::error_code ec, std::size_t bytes) mutable
+                    {
+                        self->OnReadView(std::move(handler), self->Disarm(deadline, ec), bytes);
+                    }));
+            }));
+    }
+
+    virtual void AsyncReadStream(ChunkHandler handler, size_t chunk_size = 65536, std::chrono::milliseconds timeout = DefaultTimeout) override
+    {
+        if (!IsOpen() || _read_loop)
+        {
+            _err = _read_loop ? "Trying to stream a message while the read loop is running" : "Trying to read message while not connected";
+            _logger->LogError("WebSocket.AsyncReadStream", _err);
+            auto ec = _read_loop ? net::error::operation_not_supported : net::error::not_connected;
+            net::post(_strand, [handler = std::move(handler), ec]() { handler(ec, std::string_view(), true); });
+            return;
+        }
+        net::dispatch(_strand, Recycled([self = Self(), handler = std::move(handler), chunk_size, timeout]() mutable
+            {
+                if (self->_view_out.exchange(true))
+                {
+                    self->_err = "Trying to read message while a message view is still held";
+                    self->_logger->LogError("WebSocket.AsyncReadStream", self->_err);
+                    net::post(self->_strand, [handler = std::move(handler)]() { handler(net::error::already_started, std::string_view(), true); });
+                    return;
+                }
+                self->_ec.clear();
+                self->_stream_bytes = 0;
+                //the limit guards against buffering a huge message, which streaming doesn't do
+                self->ws->read_message_max(0);
+                self->ReadChunk(std::move(handler), chunk_size, timeout);
+            }));
+    }
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+    /** Awaitable forms of AsyncConnect, Enqueue and AsyncRead for coroutines started with net::co_spawn:
+    `co_await sock->async_read(msg)`. Errors are thrown as system_error unless the token says otherwise (e.g.
+    `net::redirect_error(net::use_awaitable, ec)`); any other completion token works too. Reads and writes use
+    the SetOperationTimeout deadline. With Boost 1.77+ the operations honour cancellation slots: since a websocket
+    op can't be cancelled on its own, a cancelled operation closes the connection, like an expired deadline.
+    */
+    template<typename CompletionToken = net::use_awaitable_t<>>
+    auto async_connect(const std::string& uri, const std::string& port, CompletionToken&& token = {})
+    {
+        return Compose<void(boost::system::error_code)>(std::forward<CompletionToken>(token), "WebSocket.async_connect",
+            [self = Self(), uri, port](auto done) { self->AsyncConnect(uri, port, std::move(done)); });
+    }
+
+    /** The write queue takes `data` over, so it needn't outlive the call.
+    */
+    template<typename CompletionToken = net::use_awaitable_t<>>
+    auto async_write(std::string data, CompletionToken&& token = {})
+    {
+        return Compose<void(boost::system::error_code)>(std::forward<CompletionToken>(token), "WebSocket.async_write",
+            [self = Self(), data = std::move(data)](auto done) mutable { self->Enqueue(std::move(data), std::move(done)); });
+    }
+
+    /** Completes with the message size once the next message is in `buffer`.
+    */
+    template<typename CompletionToken = net::use_awaitable_t<>>
+    auto async_read(std::string& buffer, CompletionToken&& token = {})
+    {
+        return Compose<void(boost::system::error_code, std::size_t)>(std::forward<CompletionToken>(token), "WebSocket.async_read",
+            [self = Self(), &buffer](auto done)
+            {
+                self->AsyncRead([&buffer, done](boost::system::error_code ec, std::string msg)
+                    {
+                        auto size = msg.size();
+                        buffer = std::move(msg);
+                        done(ec, size);
+                    });
+            });
+    }
+#endif
+
+    virtual bool StartReadLoop(size_t capacity = 4096, ReadHandler handler = nullptr) override
+    {
+        if (!_external_loop)
+        {
+            _err = "Read loop requires a socket driven by an external event loop";
+            _logger->LogError("WebSocket.StartReadLoop", _err);
+            return false;
+        }
+        if (!IsOpen())
+        {
+            _err = "Trying to start read loop while not connected";
+            _logger->LogError("WebSocket.StartReadLoop", _err);
+            return false;
+        }
+        if (_view_out)
+        {
+            _err = "Trying to start read loop while a message view is still held";
+            _logger->LogError("WebSocket.StartReadLoop", _err);
+            return false;
+        }
+        if (_read_loop.exchange(true))
+        {
+            return true;
+        }
+        if (!handler && (!_inbound || _inbound_capacity != capacity))
+        {
+            _inbound = std::make_unique<boost::lockfree::spsc_queue<std::string>>(capacity);
+            _inbound_capacity = capacity;
+        }
+        net::dispatch(_strand, [self = Self(), handler = std::move(handler)]() mutable
+            {
+                self->_loop_handler = std::move(handler);
+                self->ReadLoop();
+            });
+        return true;
+    }
+
+    virtual void StopReadLoop() override
+    {
+        _read_loop = false;
+    }
+
+    virtual bool IsReadLoopRunning() const override
+    {
+        return _read_loop;
+    }
+
+    virtual bool PopMessage(std::string& ret) override
+    {
+        if (!_inbound)
+        {
+            return false;
+        }
+        return _inbound->consume_one([&ret](std::string& msg) { ret = std::move(msg); });
+    }
+
+    virtual bool StartHeartbeat(const HeartbeatOptions& options, CompletionHandler on_dead = nullptr) override
+    {
+        if (!_read_loop)
+        {
+            _err = "Trying to start heartbeat without the read loop, pongs would go unseen";
+            _logger->LogError("WebSocket.StartHeartbeat", _err);
+            return false;
+        }
+        net::dispatch(_strand, [self = Self(), options, on_dead = std::move(on_dead)]() mutable
+            {
+                self->_hb = options;
+                self->_hb_dead = std::move(on_dead);
+                {
+                    std::lock_guard<std::mutex> lock(self->_rtt_mutex);
+                    if (!self->_rtt)
+                    {
+                        self->_rtt = std::make_unique<RollingHistogram>(options.rtt_window);
+                    }
+                }
+                if (!self->_hb_timer)
+                {
+                    self->_hb_timer = std::make_unique<StrandTimer>(self->_strand);
+                }
+                if (!self->_hb_running)
+                {
+                    self->_hb_running = true;
+                    self->_hb_waiting = false;
+                    self->_hb_missed = 0;
+                    self->ArmHeartbeat();
+                }
+            });
+        return true;
+    }
+
+    virtual void StopHeartbeat() override
+    {
+        net::dispatch(_strand, [self = Self()]()
+            {
+                self->_hb_running = false;
+                if (self->_hb_timer)
+                {
+                    self->_hb_timer->cancel();
+                }
+            });
+    }
+
+    virtual void SetBufferPool(std::shared_ptr<BufferPool> pool) override
+    {
+        if (pool)
+        {
+            _message_max = pool->GetOptions().connection_limit;
+            _retain_bytes = pool->GetOptions().retain_bytes;
+        }
+        else
+        {
+            _message_max = 1ull << 26;
+            _retain_bytes = (std::numeric_limits<size_t>::max)();
+        }
+        _buffer = ReceiveBuffer(_message_max, PoolAllocator<char>(std::move(pool)));
+    }
+
+    virtual Histogram RttHistogram() override
+    {
+        std::lock_guard<std::mutex> lock(_rtt_mutex);
+        return _rtt ? _rtt->Snapshot() : Histogram();
+    }
+
+    virtual std::chrono::nanoseconds LastRtt() const override
+    {
+        return std::chrono::nanoseconds(_last_rtt.load());
+    }
+
+    virtual ~WebSocketBase()
+    {
+        if (this->IsOpen())
+        {
+            ws->close(websocket::close_code::normal, _ec);
+        }
+    }
+
+protected:
+
+    WebSocketBase(std::shared_ptr<ILogger> logger, net::io_context& _ioc, Transport transport)
+        : ISocket(), ioc(_ioc), _strand(net::make_strand(_ioc)), _chain(ws, _stats, _strand, std::move(transport))
+    {
+        opt = websocket::stream_base::timeout{ std::chrono::seconds(60), std::chrono::seconds(60), true };
+        _logger = logger;
+    }
+
+    std::shared_ptr<WebSocketBase<Transport>> Self()
+    {
+        return std::static_pointer_cast<WebSocketBase<Transport>>(this->shared_from_this());
     }
 
-    virtual bool ReConnect() override
+    /*For the per-message operations: their state is allocated from the connection's arena instead of the heap.
+    `handler` must hold the socket.*/
+    template<typename Handler>
+    ArenaHandler<typename std::decay<Handler>::type> Recycled(Handler&& handler)
     {
-        ioc.restart();
-        if (is_connected)
+        return MakeArenaHandler(_arena, std::forward<Handler>(handler));
+    }
+
+    /*Starts an asynchronous operation through `initiate(notify)` and blocks until it calls `notify()`.
+    Runs the io_context itself unless it is driven by an external loop.*/
+    template<typename Initiate>
+    bool Await(const std::string& sender, Initiate&& initiate)
+    {
+        if (_external_loop)
         {
-            Close();
+            if (_strand.running_in_this_thread())
+            {
+                _err = "Blocking call from the socket's own event loop thread";
+                _logger->LogError(sender, _err);
+                return false;
+            }
+            std::promise<void> prom;
+            auto fut = prom.get_future();
+            initiate([&prom]() { prom.set_value(); });
+            fut.wait();
+            return true;
         }
 
-        std::promise<bool> prom;
-        auto fut = prom.get_future();
-        success_ret = std::move(prom);
-
-        tcp::resolver resolver(net::make_strand(ioc));
-        _ec.clear();
-        auto bnd = beast::bind_front_handler(&WebSocketBase<T>::OnResolve, std::static_pointer_cast<WebSocketBase<T>>(this->shared_from_this()));
-        resolver.async_resolve(_domen, _port, std::move(bnd));
-        ioc.run();
-        if (fut.wait_for(std::chrono::microseconds(0)) != std::future_status::ready)
+        bool done = false;
+        ioc.restart();
+        initiate([&done]() { done = true; });
+        while (!done && ioc.run_one())
+        {
+        }
+        if (!done)
         {
             _err = "io_context didn't run correctly";
-            _logger->LogError("WebSocket.ReConnect", _err);
+            _logger->LogError(sender, _err);
             return false;
         }
+        return true;
+    }
 
-        is_connected = fut.get();
-        if (is_connected)
+    bool WaitInbound(std::string& ask, std::chrono::milliseconds timeout)
+    {
+        if (timeout == DefaultTimeout)
         {
-            _logger->LogMessage("WebSocket.connect", "Succesfully connected to " + url);
+            timeout = _op_timeout;
+        }
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        int idle = 0;
+        for (;;)
+        {
+            if (PopMessage(ask))
+            {
+                return true;
+            }
+            if (timeout.count() > 0 && std::chrono::steady_clock::now() >= deadline)
+            {
+                //nothing is in flight on our behalf, so the connection stays usable
+                _ec = net::error::timed_out;
+                _err = "No message from " + url + " within " + std::to_string(timeout.count()) + " ms";
+                ask = "";
+                return false;
+            }
+            if (!_read_loop)
+            {
+                if (PopMessage(ask))
+                {
+                    return true;
+                }
+                _err = "Read loop stopped: " + _ec.message();
+                ask = "";
+                return false;
+            }
+            if (++idle < 64)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
         }
-        return is_connected;
     }
 
-    virtual bool Write(const std::string& data) override
+    void Push(Outbound out, std::chrono::milliseconds timeout, const char* sender)
     {
         if (!IsOpen())
         {
             _err = "Trying to write message while not connected";
-            _logger->LogError("WebSocket.Write", _err);
-            return false;
+            _logger->LogError(sender, _err);
+            if (out.handler)
+            {
+                Fail(std::move(out.handler), net::error::not_connected);
+            }
+            return;
         }
+        out.queued = std::chrono::steady_clock::now();
+        if (timeout == DefaultTimeout)
+        {
+            timeout = _op_timeout;
+        }
+        out.deadline = timeout.count() > 0 ? out.queued + timeout : std::chrono::steady_clock::time_point::max();
+        {
+            std::lock_guard<std::mutex> lock(_out_mutex);
+            if (_outbound.full())
+            {
+                _outbound.set_capacity((std::max)(_outbound.capacity() * 2, size_t(64)));
+            }
+            _outbound.push_back(std::move(out));
+            if (_write_active)
+            {
+                return;
+            }
+            _write_active = true;
+        }
+        net::dispatch(_strand, Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::DoWrite, Self())));
+    }
 
-        ioc.restart();
-        std::promise<bool> prom;
-        auto fut = prom.get_future();
-        success_ret = std::move(prom);
-
+    /*The single writer: runs on the strand, takes the next message (or a batch of small ones) off the queue.*/
+    virtual void DoWrite()
+    {
+        std::unique_lock<std::mutex> lock(_out_mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (!_outbound.empty() && _outbound.front().deadline <= now)
+        {
+            //timed out while still queued: drop without touching the connection
+            std::vector<CompletionHandler> expired;
+            while (!_outbound.empty() && _outbound.front().deadline <= now)
+            {
+                if (_outbound.front().handler)
+                {
+                    expired.push_back(std::move(_outbound.front().handler));
+                }
+                _outbound.pop_front();
+            }
+            lock.unlock();
+            for (auto& handler : expired)
+            {
+                handler(net::error::timed_out);
+            }
+            DoWrite();
+            return;
+        }
+        if (_outbound.empty())
+        {
+            _write_active = false;
+            return;
+        }
         _ec.clear();
-        ws->async_write(boost::asio::buffer(data), beast::bind_front_handler(&WebSocketBase<T>::OnWrite, std::static_pointer_cast<WebSocketBase<T>>(this->shared_from_this())));
-
-        ioc.run();
-        if (fut.wait_for(std::chrono::microseconds(0)) != std::future_status::ready)
+        auto& front = _outbound.front();
+        if (_coalesce_bytes > 0 && front.is_owned && front.owned.size() < _coalesce_bytes)
         {
-            _err = "io_context didn't run correctly";
-            _logger->LogError("WebSocket.Write", _err);
-            return false;
+            size_t total = 0;
+            size_t count = 0;
+            for (auto& out : _outbound)
+            {
+                if (!out.is_owned || total + out.owned.size() + _coalesce_separator.size() > _coalesce_bytes)
+                {
+                    break;
+                }
+                total += out.owned.size() + _coalesce_separator.size();
+                ++count;
+            }
+            auto waited = std::chrono::steady_clock::now() - front.queued;
+            if (count == _outbound.size() && waited < _coalesce_delay)
+            {
+                //everything queued still fits: wait for more company, but not past the latency budget
+                if (!_coalesce_timer)
+                {
+                    _coalesce_timer = std::make_unique<StrandTimer>(_strand);
+                }
+                _coalesce_timer->expires_after(_coalesce_delay - std::chrono::duration_cast<std::chrono::microseconds>(waited));
+                _coalesce_timer->async_wait(Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnCoalesceTimer, Self())));
+                return;
+            }
+            if (count > 1)
+            {
+                _batch.clear();
+                _batch_handlers.clear();
+                auto deadline = std::chrono::steady_clock::time_point::max();
+                for (size_t i = 0; i < count; ++i)
+                {
+                    auto& out = _outbound.front();
+                    if (i > 0)
+                    {
+                        _batch += _coalesce_separator;
+                    }
+                    _batch += out.owned;
+                    deadline = (std::min)(deadline, out.deadline);
+                    if (out.handler)
+                    {
+                        _batch_handlers.push_back(std::move(out.handler));
+                    }
+                    _outbound.pop_front();
+                }
+                lock.unlock();
+                _write_count = count;
+                ArmWriteDeadline(deadline);
+                ws->async_write(net::buffer(_batch), Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnWrite, Self())));
+                return;
+            }
+        }
+        _current = std::move(front);
+        _outbound.pop_front();
+        lock.unlock();
+        _write_count = 1;
+        ArmWriteDeadline(_current.deadline);
+        _batch_handlers.clear();
+        if (_current.handler)
+        {
+            _batch_handlers.push_back(std::move(_current.handler));
+        }
+        if (_current.is_owned)
+        {
+            ws->async_write(net::buffer(_current.owned), Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnWrite, Self())));
+        }
+        else if (_current.is_single)
+        {
+            ws->async_write(_current.single, Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnWrite, Self())));
+        }
+        else
+        {
+            //by reference: the layers below copy the sequence they are given, a vector every time
+            ws->async_write(beast::buffers_range_ref(_current.buffers), Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnWrite, Self())));
         }
-        return fut.get();
     }
 
-    virtual bool Ping(const std::string& data = "") override
+    void ArmWriteDeadline(std::chrono::steady_clock::time_point deadline)
     {
-        if (!IsOpen())
+        _write_expired = false;
+        if (deadline == std::chrono::steady_clock::time_point::max())
         {
-            _err = "Trying to write message while not connected";
-            _logger->LogError("WebSocket.Ping", _err);
-            return false;
+            return;
         }
+        if (!_write_timer)
+        {
+            _write_timer = std::make_unique<StrandTimer>(_strand);
+        }
+        _write_timer->expires_at(deadline);
+        //holds the socket (the arena needs it); OnWrite cancels the wait as soon as the write is done
+        _write_timer->async_wait(Recycled([self = Self()](boost::system::error_code ec)
+            {
+                if (!ec)
+                {
+                    self->_write_expired = true;
+                    self->DeadlineExpired("WebSocket.Write");
+                }
+            }));
+    }
 
-        ioc.restart();
-        std::promise<bool> prom;
-        auto fut = prom.get_future();
-        success_ret = std::move(prom);
+    /*Per-operation deadline for reads and pings. Beast can't cancel a single websocket operation, so when the
+    deadline passes first the transport is closed and the operation completes with timed_out (see Disarm).*/
+    struct Deadline
+    {
+        StrandTimer timer;
+        bool expired = false;
 
-        _ec.clear();
-        ws->async_ping(beast::websocket::ping_data(data), beast::bind_front_handler(&WebSocketBase<T>::OnPing, std::static_pointer_cast<WebSocketBase<T>>(this->shared_from_this())));
+        explicit Deadline(const net::strand<net::io_context::executor_type>& strand) : timer(strand) {}
+    };
 
-        ioc.run();
-        if (fut.wait_for(std::chrono::microseconds(0)) != std::future_status::ready)
+    /*On the strand. Returns nullptr if the operation has no deadline.*/
+    std::shared_ptr<Deadline> ArmDeadline(std::chrono::milliseconds timeout, const char* sender)
+    {
+        if (timeout == DefaultTimeout)
         {
-            _err = "io_context didn't run correctly";
-            _logger->LogError("WebSocket.Ping", _err);
-            return false;
+            timeout = _op_timeout;
+        }
+        if (timeout.count() <= 0)
+        {
+            return nullptr;
         }
-        return fut.get();
+        //both the deadline and its wait come from the arena; the wait holds the socket until Disarm cancels it
+        auto deadline = std::allocate_shared<Deadline>(HandlerAllocator<Deadline>(_arena), _strand);
+        deadline->timer.expires_after(timeout);
+        std::weak_ptr<Deadline> weak_deadline = deadline;
+        deadline->timer.async_wait(Recycled([self = Self(), weak_deadline, sender](boost::system::error_code ec)
+            {
+                auto deadline = weak_deadline.lock();
+                if (ec || !deadline)
+                {
+                    return;
+                }
+                deadline->expired = true;
+                self->DeadlineExpired(sender);
+            }));
+        return deadline;
     }
 
-    bool Read(std::string& ask) override
+    /*Stops the deadline of a completed operation and turns the abort its expiry caused into timed_out.*/
+    /*Also reports timed_out for a read the idle watchdog cut off.*/
+    boost::system::error_code Disarm(const std::shared_ptr<Deadline>& deadline, boost::system::error_code ec)
     {
-        if (!IsOpen())
+        bool expired = _idle_expired;
+        if (deadline)
         {
-            _err = "Trying to read message while not connected";
-            _logger->LogError("WebSocket.Read", _err);
-            ask = "";
-            return false;
+            deadline->timer.cancel();
+            expired = expired || deadline->expired;
         }
-        ioc.restart();
-        std::promise<bool> prom;
-        auto fut = prom.get_future();
-        success_ret = std::move(prom);
+        return ec && expired ? boost::system::error_code(net::error::timed_out) : ec;
+    }
 
-        std::promise<std::string> ret;
-        auto futstr = ret.get_future();
+    /*Asio op driving one of the callback-style calls for a completion token: the first invocation hands `start`
+a copyable callback, which completes the op with whatever it is called with.*/
+    template<typename Start>
+    struct ComposedCall
+    {
+        Start start;
+        std::weak_ptr<WebSocketBase<Transport>> socket;
+        const char* sender;
 
-        _ec.clear();
-        auto bnd = beast::bind_front_handler(&WebSocketBase<T>::OnRead, std::static_pointer_cast<WebSocketBase<T>>(this->shared_from_this()), std::move(ret));
-        ws->async_read(_buffer, std::move(bnd));
-        ioc.run();
+        template<typename Op>
+        void operator()(Op& op)
+        {
+#if BOOST_ASIO_VERSION >= 101900
+            auto slot = op.get_cancellation_state().slot();
+            if (slot.is_connected())
+            {
+                slot.assign([socket = socket, sender = sender](net::cancellation_type)
+                    {
+                        if (auto self = socket.lock())
+                        {
+                            net::dispatch(self->_strand, [self, sender]() { self->Cancelled(sender); });
+                        }
+                    });
+            }
+#endif
+            //moving the op moves this object too
+            auto begin = std::move(start);
+            auto shared = std::make_shared<Op>(std::move(op));
+            begin([shared](boost::system::error_code ec, auto... result) { (*shared)(ec, std::move(result)...); });
+        }
 
-        if (futstr.wait_for(std::chrono::microseconds(0)) != std::future_status::ready)
+        template<typename Op, typename... Result>
+        void operator()(Op& op, boost::system::error_code ec, Result... result)
         {
-            _err = "io_context didn't run correctly";
-            _logger->LogError("WebSocket.Read", _err);
-            ask = "";
-            return false;
+#if BOOST_ASIO_VERSION >= 101900
+            op.get_cancellation_state().slot().clear();
+#endif
+            op.complete(ec, std::move(result)...);
         }
-        ask = futstr.get();
-        return fut.get();
+    };
+
+    template<typename Signature, typename CompletionToken, typename Start>
+    auto Compose(CompletionToken&& token, const char* sender, Start start)
+    {
+        return net::async_compose<CompletionToken, Signature>(ComposedCall<Start>{ std::move(start), Self(), sender }, token, _strand);
     }
 
-    virtual bool IsOpen() override
+    /*On the strand; the operation in progress then fails.*/
+    virtual void Cancelled(const char* sender)
     {
-        return is_connected && ws.get() && ws->is_open() && beast::get_lowest_layer(*ws.get()).socket().is_open();
+        SetError(net::error::operation_aborted);
+        _err = "Operation on " + url + " cancelled, closing the connection";
+        _logger->LogError(sender, _err);
+        is_connected = false;
+        _chain.Cancel();
+        if (ws)
+        {
+            beast::get_lowest_layer(*ws).close();
+        }
     }
 
-    virtual bool Close() override
+    virtual void DeadlineExpired(const char* sender)
     {
-        if (!ws)
+        SetError(net::error::timed_out);
+        _err = "Operation on " + url + " timed out, closing the connection";
+        _logger->LogError(sender, _err);
+        is_connected = false;
+        if (ws)
         {
-            return true;
+            beast::get_lowest_layer(*ws).close();
         }
-        ws->close(websocket::close_code::normal, _ec);
-        if (_ec)
+    }
+
+    /*The idle timeout of `opt`, checked against the wire counter once per period: with keep-alive pings a quiet
+    half-timeout sends a ping and the next quiet one closes the connection, without them a quiet timeout does.*/
+    void WatchIdle()
+    {
+        _idle_expired = false;
+        if (opt.idle_timeout == websocket::stream_base::none())
         {
-            _err += "Error while trying to disconnect from " + url + ": " + _ec.message();
-            _logger->LogError("WebSocketS.Close", _err);
-            return false;
+            return;
         }
-        _ec.clear();
-        _logger->LogMessage("WebSocket.Close", "Succesfully closed connection to " + url);
-        return true;
+        if (!_idle_timer)
+        {
+            _idle_timer = std::make_unique<StrandTimer>(_strand);
+        }
+        _idle_seen = _stats.WireBytesReceived();
+        _idle_pinged = false;
+        ArmIdle();
     }
 
-    virtual ~WebSocketBase()
+    void ArmIdle()
     {
-        if (this->IsOpen())
+        std::weak_ptr<WebSocketBase<Transport>> weak = Self();
+        _idle_timer->expires_after(opt.keep_alive_pings ? opt.idle_timeout / 2 : opt.idle_timeout);
+        _idle_timer->async_wait([weak](boost::system::error_code ec)
+            {
+                if (auto self = weak.lock())
+                {
+                    self->OnIdleCheck(ec);
+                }
+            });
+    }
+
+    virtual void OnIdleCheck(boost::system::error_code ec)
+    {
+        if (ec || !is_connected || !ws || !ws->is_open())
+        {
+            return;
+        }
+        auto seen = _stats.WireBytesReceived();
+        if (seen != _idle_seen)
+        {
+            _idle_seen = seen;
+            _idle_pinged = false;
+        }
+        else if (opt.keep_alive_pings && !_idle_pinged)
+        {
+            _idle_pinged = true;
+            ws->async_ping({}, [self = Self()](boost::system::error_code) {});
+        }
+        else
         {
-            this->Close();
+            SetError(net::error::timed_out);
+            _err = "Nothing received from " + url + " within the idle timeout, closing";
+            _logger->LogError("WebSocketBase.Idle", _err);
+            _idle_expired = true;
+            is_connected = false;
+            beast::get_lowest_layer(*ws).close();
+            return;
         }
+        ArmIdle();
     }
 
-protected:
+    virtual void OnCoalesceTimer(boost::system::error_code ec)
+    {
+        boost::ignore_unused(ec);
+        DoWrite();
+    }
 
-    WebSocketBase(std::shared_ptr<ILogger> logger, net::io_context& _ioc) : ioc(_ioc), ISocket()
+    void Fail(CompletionHandler handler, boost::system::error_code ec)
     {
-        opt = websocket::stream_base::timeout{ std::chrono::seconds(60), std::chrono::seconds(60), true };
-        _logger = logger;
+        SetError(ec);
+        net::post(_strand, [handler = std::move(handler), ec]() { handler(ec); });
     }
 
-    virtual void OnResolve(beast::error_code ec, tcp::resolver::results_type res)
+    void FinishConnect(boost::system::error_code ec)
     {
-        if (ec)
+        _stats.ConnectDone(ec);
+        is_connected = !ec;
+        _hb_waiting = false;
+        _hb_missed = 0;
+        if (is_connected)
         {
-            _ec = ec;
-            _err = "Error while resolving domen name " + _domen + ": " + ec.message();
-            _logger->LogError("WebSocket.OnResolve", _err);
-            success_ret.set_value(false);
-            ioc.stop();
-            return;
+            LOG_INFO(_logger, "WebSocket.connect", "Succesfully connected to {}", url);
+        }
+        auto handler = std::move(_connect_handler);
+        _connect_handler = nullptr;
+        if (handler)
+        {
+            handler(ec);
         }
-        Connect(res);
     }
 
-    virtual void Connect(tcp::resolver::results_type res)
+    virtual void Resolve()
     {
         _ec.clear();
-        beast::get_lowest_layer(*ws).expires_after(std::chrono::seconds(60));
-        auto bnd = std::bind(&WebSocketBase<T>::OnConnect, std::static_pointer_cast<WebSocketBase<T>>(this->shared_from_this()), std::placeholders::_1);
-        beast::get_lowest_layer(*ws.get()).async_connect(res, std::move(bnd));
+        _connect_deadline = std::chrono::steady_clock::now() + _connect_timeout;
+        _chain.Start(_resolver_cache, _domen, _port, _path, _connect_deadline, opt,
+            [this](typename ConnectChain<Transport>::Stream& stream)
+            {
+                stream.control_callback([this](websocket::frame_type kind, beast::string_view payload)
+                    {
+                        if (kind == websocket::frame_type::pong)
+                        {
+                            OnPong(payload);
+                        }
+                    });
+                stream.binary(_binary);
+                if (_compression.enabled)
+                {
+                    stream.set_option(Deflate(_compression));
+                }
+                stream.read_message_max(_message_max);
+            },
+            beast::bind_front_handler(&WebSocketBase<Transport>::OnConnected, Self()));
     }
 
-    virtual void OnConnect(beast::error_code ec)
+    virtual void OnReConnectClose(beast::error_code ec)
     {
-        if (ec)
+        boost::ignore_unused(ec);
+        Resolve();
+    }
+
+    static websocket::permessage_deflate Deflate(const CompressionOptions& options)
+    {
+        websocket::permessage_deflate pmd;
+        pmd.client_enable = true;
+        pmd.client_max_window_bits = options.client_max_window_bits;
+        pmd.server_max_window_bits = options.server_max_window_bits;
+        pmd.client_no_context_takeover = options.client_no_context_takeover;
+        pmd.server_no_context_takeover = options.server_no_context_takeover;
+        pmd.compLevel = options.level;
+        pmd.memLevel = options.mem_level;
+        SetSizeThreshold(pmd, options.min_size);
+        return pmd;
+    }
+
+    template<typename Options>
+    static void SetSizeThreshold(Options& pmd, size_t min_size)
+    {
+        if constexpr (HasSizeThreshold<Options>::value)
         {
-            _ec = ec;
-            _err = "Error while connecting to " + url + ": " + ec.message();
-            _logger->LogError("WebSocketBase.OnConnect", _err);
-            success_ret.set_value(false);
-            ioc.stop();
-            return;
+            pmd.msg_size_threshold = min_size;
         }
-        ec.clear();
-        beast::get_lowest_layer(*ws).expires_never();
-        auto endp = beast::get_lowest_layer(*ws.get()).socket().remote_endpoint(ec);
-        auto endp2 = beast::get_lowest_layer(*ws.get()).socket().local_endpoint(ec);
-        if (!ec)
+        else
         {
-            _logger->LogMessage("WebSocket.OnConnect", "Connected to: " + boost::lexical_cast<std::string>(endp) + ", from: " + boost::lexical_cast<std::string>(endp2), true);
+            boost::ignore_unused(pmd, min_size);
         }
-        ws->set_option(opt);
-        ws->read_message_max(1ull << 26);
-        Handshake(_domen + ":" + _port, _path);
     }
 
-    virtual void OnHandshake(beast::error_code ec)
+    virtual void OnConnected(boost::system::error_code ec, ConnectPhase phase)
     {
-        if (ec.failed())
+        if (ec)
         {
-            _ec = ec;
-            _err = "Error while performing websocket handshake with " + url + ": " + ec.message();
-            _logger->LogError("WebSocket.OnHandshake", _err);
-            success_ret.set_value(false);
-            ioc.stop();
+            SetError(ec);
+            switch (phase)
+            {
+            case ConnectPhase::Resolve: _err = "Error while resolving domen name " + _domen; break;
+            case ConnectPhase::TcpConnect: _err = "Error while connecting to " + url; break;
+            case ConnectPhase::TlsHandshake: _err = "Error while performing SSL handshake with " + url; break;
+            default: _err = "Error while performing websocket handshake with " + url; break;
+            }
+            _err += ": " + ec.message();
+            _logger->LogError("WebSocket.Connect", _err);
+            FinishConnect(ec);
             return;
         }
-        ec.clear();
-        auto endp = beast::get_lowest_layer(*ws.get()).socket().remote_endpoint(ec);
-        auto endp2 = beast::get_lowest_layer(*ws.get()).socket().local_endpoint(ec);
-        success_ret.set_value(true);
-        ioc.stop();
+        if (LOG_ENABLED(_logger, LogLevel::Info))
+        {
+            auto endp = beast::get_lowest_layer(*ws).socket().remote_endpoint(ec);
+            auto endp2 = beast::get_lowest_layer(*ws).socket().local_endpoint(ec);
+            if (!ec)
+            {
+                LOG_INFO_CONSOLE(_logger, "WebSocket.OnConnect", "Connected to: {}, from: {}", endp, endp2);
+            }
+            ec.clear();
+        }
+        //Beast would re-arm its idle timer with every read, copying the strand onto the heap each time;
+        //WatchIdle applies the same idle timeout from one timer per period instead
+        auto stream_opt = opt;
+        stream_opt.idle_timeout = websocket::stream_base::none();
+        stream_opt.keep_alive_pings = false;
+        ws->set_option(stream_opt);
+        WatchIdle();
+        FinishConnect(ec);
     }
 
-    virtual void Handshake(std::string header, std::string path)
+    virtual void OnClose(CompletionHandler handler, beast::error_code ec)
     {
-        auto bnd = beast::bind_front_handler(&WebSocketBase<T>::OnHandshake, std::static_pointer_cast<WebSocketBase<T>>(this->shared_from_this()));
-        ws->async_handshake(header, path, std::move(bnd));
+        is_connected = false;
+        if (ec)
+        {
+            SetError(ec);
+            _err += "Error while trying to disconnect from " + url + ": " + ec.message();
+            _logger->LogError("WebSocketS.Close", _err);
+            handler(ec);
+            return;
+        }
+        LOG_INFO(_logger, "WebSocket.Close", "Succesfully closed connection to {}", url);
+        handler(ec);
     }
 
     virtual void OnWrite(boost::system::error_code ec, std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
-
+        if (_write_timer)
+        {
+            _write_timer->cancel();
+        }
+        if (ec && _write_expired)
+        {
+            ec = net::error::timed_out;
+        }
+        _write_expired = false;
         if (ec)
         {
-            _ec = ec;
+            SetError(ec);
             _err = "Error while writing to " + url + ": " + ec.message();
             _logger->LogError("WebSocketBase.Write", _err);
-            success_ret.set_value(false);
-            ioc.stop();
+        }
+        else
+        {
+            _stats.Sent(bytes_transferred, _write_count);
+        }
+        _done_handlers.swap(_batch_handlers);
+        for (auto& handler : _done_handlers)
+        {
+            handler(ec);
+        }
+        _done_handlers.clear();
+        if (ec)
+        {
+            //the stream is unusable after a failed write, fail whatever is still queued
+            OutboundQueue dropped;
+            {
+                std::lock_guard<std::mutex> lock(_out_mutex);
+                dropped.swap(_outbound);
+                _write_active = false;
+            }
+            for (auto& out : dropped)
+            {
+                if (out.handler)
+                {
+                    out.handler(ec);
+                }
+            }
             return;
         }
-        success_ret.set_value(true);
-        ioc.stop();
+        DoWrite();
     }
 
-    virtual void OnPing(boost::system::error_code ec)
+    virtual void OnPing(CompletionHandler handler, boost::system::error_code ec)
     {
-
         if (ec)
         {
-            _ec = ec;
+            SetError(ec);
             _err = "Error while writing to " + url + ": " + ec.message();
             _logger->LogError("WebSocketBase.Ping", _err);
-            success_ret.set_value(false);
-            ioc.stop();
-            return;
         }
-        success_ret.set_value(true);
-        ioc.stop();
+        handler(ec);
     }
 
-    virtual void OnRead(std::promise<std::string> prom, boost::system::error_code ec, std::size_t bytes_transferred)
+    virtual void OnRead(ReadHandler handler, boost::system::error_code ec, std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
-
         if (ec)
         {
-            _ec = ec;
+            SetError(ec);
             _err = "Error while reading from " + url + ": " + ec.message();
             _logger->LogError("WebSocketBase.Read", _err);
-            prom.set_value("");
-            success_ret.set_value(false);
-            ioc.stop();
+            handler(ec, "");
             return;
         }
 
-        prom.set_value(beast::buffers_to_string(_buffer.data()));
+        _stats.Received(bytes_transferred);
+        auto msg = beast::buffers_to_string(_buffer.data());
+        RecycleBuffer();
+        handler(ec, std::move(msg));
+    }
+
+    virtual void OnReadView(ViewHandler handler, boost::system::error_code ec, std::size_t bytes_transferred)
+    {
+        if (ec)
+        {
+            SetError(ec);
+            _err = "Error while reading from " + url + ": " + ec.message();
+            _logger->LogError("WebSocketBase.ReadView", _err);
+            RecycleBuffer();
+            _view_out = false;
+            handler(ec, MessageView());
+            return;
+        }
 
-        _buffer.consume(_buffer.size());
-        success_ret.set_value(true);
-        ioc.stop();
+        _stats.Received(bytes_transferred);
+        auto data = _buffer.data();
+        handler(ec, MessageView(this->shared_from_this(), std::string_view(static_cast<const char*>(data.data()), data.size())));
     }
-};
 
+    virtual void ReadChunk(ChunkHandler handler, size_t chunk_size, std::chrono::milliseconds timeout)
+    {
+        auto deadline = ArmDeadline(timeout, "WebSocket.ReadStream");
+        ws->async_read_some(_buffer, chunk_size, Recycled([self = Self(), handler = std::move(handler), chunk_size, timeout, deadline](boost::system::error_code ec, std::size_t bytes) mutable
+            {
+                self->OnChunk(std::move(handler), chunk_size, timeout, self->Disarm(deadline, ec), bytes);
+            }));
+    }
 
-class WebSocketS : public WebSocketBase<ssl::stream<beast::tcp_stream>>
-{
-    ssl::context ctx;
+    virtual void OnChunk(ChunkHandler handler, size_t chunk_size, std::chrono::milliseconds timeout, boost::system::error_code ec, std::size_t bytes_transferred)
+    {
+        if (ec)
+        {
+            SetError(ec);
+            _err = "Error while reading from " + url + ": " + ec.message();
+            _logger->LogError("WebSocketBase.ReadStream", _err);
+            ws->read_message_max(_message_max);
+            RecycleBuffer();
+            _view_out = false;
+            handler(ec, std::string_view(), true);
+            return;
+        }
 
-public:
+        _stream_bytes += bytes_transferred;
+        auto data = _buffer.data();
+        if (!ws->is_message_done())
+        {
+            if (bytes_transferred > 0)
+            {
+                handler(ec, std::string_view(static_cast<const char*>(data.data()), data.size()), false);
+            }
+            _buffer.clear();
+            ReadChunk(std::move(handler), chunk_size, timeout);
+            return;
+        }
+        //the socket is free for the next read before the last chunk is delivered, so the handler may start
+        //one; that chunk is therefore handed over from a copy
+        _stream_tail.assign(static_cast<const char*>(data.data()), data.size());
+        ws->read_message_max(_message_max);
+        _stats.Received(_stream_bytes);
+        RecycleBuffer();
+        _view_out = false;
+        handler(ec, _stream_tail, true);
+        if (_stream_tail.capacity() > _retain_bytes)
+        {
+            std::string().swap(_stream_tail);
+        }
+    }
 
-    WebSocketS(net::io_context& _ioc, ssl::context _ctx, std::shared_ptr<ILogger> logger) :WebSocketBase(logger, _ioc), ctx(std::move(_ctx))
+    /*Views are released from any thread, but the buffer belongs to the strand; the next read can't start before
+    _view_out is cleared there.*/
+    virtual void ReleaseView() override
     {
+        net::dispatch(_strand, Recycled([self = Self()]()
+            {
+                self->RecycleBuffer();
+                self->_view_out = false;
+            }));
     }
 
-    virtual ~WebSocketS()
+    /*Empties the receive buffer; one grown past retain_bytes goes back to the pool right away, so a burst of
+    big messages doesn't stay pinned to the connection.*/
+    void RecycleBuffer()
     {
+        _buffer.clear();
+        if (_buffer.capacity() > _retain_bytes)
+        {
+            _buffer.shrink_to_fit();
+        }
     }
 
-protected:
+    virtual void ReadLoop()
+    {
+        ws->async_read(_buffer, Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnLoopRead, Self())));
+    }
 
-    virtual void Connect(tcp::resolver::results_type res) override
+    virtual void OnLoopRead(boost::system::error_code ec, std::size_t bytes_transferred)
     {
-        this->ws = std::make_unique<websocket::stream<ssl::stream<beast::tcp_stream>>>(ioc, ctx);
-        if (!SSL_set_tlsext_host_name(ws->next_layer().native_handle(), _domen.c_str()))
+        if (ec)
+        {
+            ec = Disarm(nullptr, ec);
+            _ec = ec;
+            if (ec != websocket::error::closed && ec != net::error::operation_aborted)
+            {
+                _stats.Error(ec);
+                _err = "Error while reading from " + url + ": " + ec.message();
+                _logger->LogError("WebSocketBase.ReadLoop", _err);
+            }
+            _read_loop = false;
+            if (_loop_handler)
+            {
+                _loop_handler(ec, "");
+            }
+            return;
+        }
+
+        _stats.Received(bytes_transferred);
+        auto msg = beast::buffers_to_string(_buffer.data());
+        RecycleBuffer();
+        if (_loop_handler)
+        {
+            _loop_handler(ec, std::move(msg));
+        }
+        else if (!PushInbound(msg))
         {
-            boost::system::error_code ec{ static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
-            _err = "Error while handling ssl connection to " + _domen + ": " + ec.message();
-            _logger->LogError("WebSocketS.Connect", _err);
-            success_ret.set_value(false);
             return;
         }
-        WebSocketBase<ssl::stream<beast::tcp_stream>>::Connect(res);
+        if (_read_loop)
+        {
+            ReadLoop();
+        }
     }
 
-    virtual void OnSSLHandshake(boost::system::error_code ec)
+    /*When the queue is full the loop stops reading (so TCP flow control pushes back on the server)
+    and retries the push shortly.*/
+    bool PushInbound(std::string& msg)
     {
-        if (ec.failed())
+        auto it = std::make_move_iterator(&msg);
+        if (_inbound->push(it, it + 1) != it)
+        {
+            return true;
+        }
+        if (&msg != &_stalled)
+        {
+            _stalled = std::move(msg);
+        }
+        if (!_stall_timer)
+        {
+            _stall_timer = std::make_unique<StrandTimer>(_strand);
+        }
+        _stall_timer->expires_after(std::chrono::microseconds(200));
+        _stall_timer->async_wait(Recycled(beast::bind_front_handler(&WebSocketBase<Transport>::OnInboundStall, Self())));
+        return false;
+    }
+
+    /*The timer holds the socket weakly, so a forgotten heartbeat does not keep it alive.*/
+    void ArmHeartbeat()
+    {
+        std::weak_ptr<WebSocketBase<Transport>> weak = Self();
+        _hb_timer->expires_after(_hb.interval);
+        _hb_timer->async_wait([weak](boost::system::error_code ec)
+            {
+                if (auto self = weak.lock())
+                {
+                    self->OnHeartbeat(ec);
+                }
+            });
+    }
+
+    /*One ping in flight at a time; every interval it stays unanswered counts as a miss.
+    While the read loop is down (stopped, or not yet restarted after a reconnect) nobody reads the pongs,
+    so no pings go out and nothing counts as missed.*/
+    virtual void OnHeartbeat(boost::system::error_code ec)
+    {
+        if (ec || !_hb_running)
+        {
+            return;
+        }
+        if (!_read_loop)
+        {
+            _hb_waiting = false;
+            _hb_missed = 0;
+        }
+        else if (is_connected && ws && ws->is_open())
+        {
+            if (!_hb_waiting)
+            {
+                auto payload = std::to_string(++_hb_seq);
+                _hb_waiting = true;
+                _hb_sent = std::chrono::steady_clock::now();
+                ws->async_ping(websocket::ping_data(payload.c_str()), [self = Self()](boost::system::error_code) {});
+            }
+            else if (++_hb_missed >= _hb.max_missed)
+            {
+                PeerDead();
+            }
+        }
+        ArmHeartbeat();
+    }
+
+    virtual void OnPong(beast::string_view payload)
+    {
+        if (!_hb_waiting || payload != std::to_string(_hb_seq))
         {
-            _ec = ec;
-            _err = "Error while performing SSL handshake with " + url + ": " + ec.message();
-            _logger->LogError("WebSocketS.OnSSLHandshake", _err);
-            Close();
-            success_ret.set_value(false);
-            ioc.stop();
             return;
         }
-        auto bnd = beast::bind_front_handler(&WebSocketS::OnHandshake, std::static_pointer_cast<WebSocketS>(this->shared_from_this()));
-        ws->async_handshake(_domen + ":" + _port, _path, std::move(bnd));
+        auto rtt = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _hb_sent).count();
+        _hb_waiting = false;
+        _hb_missed = 0;
+        _last_rtt = rtt;
+        std::lock_guard<std::mutex> lock(_rtt_mutex);
+        _rtt->Record(static_cast<uint64_t>(rtt));
+    }
+
+    /*Closing the transport fails the outstanding read, which ends the read loop and tells its owner.*/
+    virtual void PeerDead()
+    {
+        _hb_waiting = false;
+        _hb_missed = 0;
+        SetError(net::error::timed_out);
+        _err = "No pong from " + url + " for " + std::to_string(_hb.max_missed * _hb.interval.count()) + " ms, closing";
+        _logger->LogError("WebSocketBase.Heartbeat", _err);
+        is_connected = false;
+        beast::get_lowest_layer(*ws).close();
+        if (_hb_dead)
+        {
+            _hb_dead(net::error::timed_out);
+        }
     }
 
-    virtual void Handshake(std::string header, std::string path) override
+    virtual void OnInboundStall(boost::system::error_code ec)
     {
-        auto bnd = beast::bind_front_handler(&WebSocketS::OnSSLHandshake, std::static_pointer_cast<WebSocketS>(this->shared_from_this()));
-        ws->next_layer().async_handshake(ssl::stream_base::client, std::move(bnd));
+        if (ec)
+        {
+            return;
+        }
+        if (!PushInbound(_stalled))
+        {
+            return;
+        }
+        if (_read_loop)
+        {
+            ReadLoop();
+        }
     }
 };
 
 
-class WebSocket : public WebSocketBase<beast::tcp_stream>
+class WebSocketS final : public WebSocketBase<TlsTransport>
 {
 public:
 
-    WebSocket(net::io_context& _ioc, std::shared_ptr<ILogger>logger) :WebSocketBase(logger, _ioc)
+    WebSocketS(net::io_context& _ioc, ssl::context _ctx, std::shared_ptr<ILogger> logger) :WebSocketBase(logger, _ioc, TlsTransport(std::move(_ctx)))
     {
-        //this->ws = std::make_unique<websocket::stream<tcp::socket>>(_ioc);
     }
 
-    virtual ~WebSocket()
+    /*Shares the context (and its session cache) with other sockets, so reconnects resume the TLS session.*/
+    WebSocketS(net::io_context& _ioc, std::shared_ptr<TlsClientContext> tls, std::shared_ptr<ILogger> logger) :WebSocketBase(logger, _ioc, TlsTransport(std::move(tls)))
     {
     }
 
-protected:
+    virtual ~WebSocketS()
+    {
+    }
+};
 
-    virtual void Connect(tcp::resolver::results_type res) override
+
+class WebSocket final : public WebSocketBase<PlainTransport>
+{
+public:
+
+    WebSocket(net::io_context& _ioc, std::shared_ptr<ILogger>logger) :WebSocketBase(logger, _ioc, PlainTransport())
+    {
+    }
+
+    virtual ~WebSocket()
     {
-        this->ws = std::make_unique<websocket::stream<beast::tcp_stream>>(ioc);
-        WebSocketBase<beast::tcp_stream>::Connect(res);
     }
 };
 
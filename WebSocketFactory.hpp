@@ -1,13 +1,22 @@
 #ifndef WEBSOCKETFACTORY_H__
 #define WEBSOCKETFACTORY_H__
 #include "WebSocket.hpp"
+#include "EventLoop.hpp"
+#include "ShardedRuntime.hpp"
 #include <memory>
+#include <mutex>
 
 class WebSocketFactory
 {
 private:
 
     static std::shared_ptr<ILogger> _default_logger, _own_logger;
+    static std::shared_ptr<SocketStatsRegistry> _stats;
+    static std::shared_ptr<ResolverCache> _resolver_cache;
+    static std::shared_ptr<BufferPool> _buffer_pool;
+    static CompressionOptions _compression;
+    static std::shared_ptr<TlsClientContext> _tls;
+    static std::mutex _tls_mutex;
 
 public:
 
@@ -28,25 +37,42 @@ public:
 
     static std::shared_ptr<ISocket> GenerateSecure(net::io_context& ioc)
     {
-        ssl::context ctx(ssl::context::sslv23);
+        auto tls = GetTlsContext();
+        std::shared_ptr<ISocket> socket;
         if (_default_logger.get())
-            return std::make_shared <WebSocketS>(ioc, std::move(ctx), _default_logger);
+            socket = std::make_shared <WebSocketS>(ioc, tls, _default_logger);
         else
-            return std::make_shared <WebSocketS>(ioc, std::move(ctx), std::make_shared<EmptyLogger>());
+            socket = std::make_shared <WebSocketS>(ioc, tls, std::make_shared<EmptyLogger>());
+        socket->AttachStats(_stats);
+        socket->SetResolverCache(_resolver_cache);
+        socket->SetBufferPool(_buffer_pool);
+        socket->SetCompression(_compression);
+        return socket;
     }
 
     static std::shared_ptr<ISocket> GenerateUnsecure(net::io_context& ioc)
     {
+        std::shared_ptr<ISocket> socket;
         if (_default_logger.get())
-            return std::make_shared <WebSocket>(ioc, _default_logger);
+            socket = std::make_shared <WebSocket>(ioc, _default_logger);
         else
-            return std::make_shared <WebSocket>(ioc, std::make_shared<EmptyLogger>());
+            socket = std::make_shared <WebSocket>(ioc, std::make_shared<EmptyLogger>());
+        socket->AttachStats(_stats);
+        socket->SetResolverCache(_resolver_cache);
+        socket->SetBufferPool(_buffer_pool);
+        socket->SetCompression(_compression);
+        return socket;
     }
 
+    /*The transport follows the URI's scheme; a URI without one ("host/path") is taken as wss when `port` is 443.*/
     static std::shared_ptr<ISocket> GenerateDefault(net::io_context& ioc, const std::string& uri, const std::string& port = "")
     {
         std::string prefix, path, uri_port, domen;
         std::tie(prefix, domen, uri_port, path) = ISocket::ParseURI(uri);
+        if (uri.find("://") == std::string::npos && port == "443")
+        {
+            prefix = "wss";
+        }
 
         if (prefix == "ws")
         {
@@ -68,6 +94,88 @@ public:
         }
     }
 
+    /*Sockets generated on a running EventLoop never drive the io_context themselves; use their Async* calls
+    (or the blocking ones from any thread other than the loop's).*/
+    static std::shared_ptr<ISocket> GenerateDefault(EventLoop& loop, const std::string& uri, const std::string& port = "")
+    {
+        auto socket = GenerateDefault(loop.Context(), uri, port);
+        if (socket)
+        {
+            socket->SetExternalLoop(true);
+        }
+        return socket;
+    }
+
+    /*Places the socket on the runtime's shards round-robin.*/
+    static std::shared_ptr<ISocket> GenerateDefault(ShardedRuntime& runtime, const std::string& uri, const std::string& port = "")
+    {
+        return GenerateDefault(runtime.Next(), uri, port);
+    }
+
+    /*Places the socket on the shard owning `key`, e.g. to keep related connections on one thread.*/
+    static std::shared_ptr<ISocket> GenerateDefault(ShardedRuntime& runtime, const std::string& uri, const std::string& port, const std::string& key)
+    {
+        return GenerateDefault(runtime.ForKey(key), uri, port);
+    }
+
+    /*Stats summed over every socket this factory has generated, including already destroyed ones;
+    `live` receives the number still alive.*/
+    static SocketStats AggregateStats(size_t* live = nullptr)
+    {
+        return _stats->Aggregate(live);
+    }
+
+    /*The TLS context every generated wss socket shares, created with default TlsOptions on first use.*/
+    static std::shared_ptr<TlsClientContext> GetTlsContext()
+    {
+        std::lock_guard<std::mutex> lock(_tls_mutex);
+        if (!_tls)
+        {
+            _tls = std::make_shared<TlsClientContext>();
+        }
+        return _tls;
+    }
+
+    /*Verification, protocol and cipher settings for sockets generated afterwards; they start with an empty
+    session cache.*/
+    static void SetTlsOptions(const TlsOptions& options)
+    {
+        auto tls = std::make_shared<TlsClientContext>(options);
+        std::lock_guard<std::mutex> lock(_tls_mutex);
+        _tls = tls;
+    }
+
+    /*DNS cache shared by the generated sockets, e.g. to pin addresses or read its hit counters.*/
+    static std::shared_ptr<ResolverCache> GetResolverCache()
+    {
+        return _resolver_cache;
+    }
+
+    /*Applies to sockets generated afterwards; nullptr makes them resolve on every connect.*/
+    static void SetResolverCache(std::shared_ptr<ResolverCache> cache)
+    {
+        _resolver_cache = cache;
+    }
+
+    /*Receive buffer pool shared by the generated sockets, e.g. to read its hit and memory counters.*/
+    static std::shared_ptr<BufferPool> GetBufferPool()
+    {
+        return _buffer_pool;
+    }
+
+    /*Applies to sockets generated afterwards; nullptr gives each of them a private buffer.*/
+    static void SetBufferPool(std::shared_ptr<BufferPool> pool)
+    {
+        _buffer_pool = pool;
+    }
+
+    /*permessage-deflate offered by sockets generated afterwards (off by default); sockets can be tuned one
+by one with ISocket::SetCompression before they connect.*/
+    static void SetCompression(const CompressionOptions& options)
+    {
+        _compression = options;
+    }
+
     static void SetDefaultLogger(std::shared_ptr<ILogger> logger)
     {
         _default_logger = logger;
@@ -80,6 +188,12 @@ public:
 };
 std::shared_ptr<ILogger> WebSocketFactory::_default_logger = std::shared_ptr<ILogger>(nullptr);
 std::shared_ptr<ILogger> WebSocketFactory::_own_logger = std::shared_ptr<ILogger>(nullptr);
+std::shared_ptr<SocketStatsRegistry> WebSocketFactory::_stats = std::make_shared<SocketStatsRegistry>();
+std::shared_ptr<ResolverCache> WebSocketFactory::_resolver_cache = std::make_shared<ResolverCache>();
+std::shared_ptr<BufferPool> WebSocketFactory::_buffer_pool = std::make_shared<BufferPool>();
+CompressionOptions WebSocketFactory::_compression;
+std::shared_ptr<TlsClientContext> WebSocketFactory::_tls = std::shared_ptr<TlsClientContext>(nullptr);
+std::mutex WebSocketFactory::_tls_mutex;
 
 
 #endif //WEBSOCKETFACTORY_H__
\ No newline at end of file
@@ -0,0 +1,846 @@
+// Open-loop load generator and latency benchmark.
+// Every client sends at fixed intended times regardless of how fast replies come back, and latency is
+// measured from the intended send time, so a stalled server shows up in the percentiles instead of
+// silently lowering the offered load (no coordinated omission).
+// Expects an echo-style server that returns the request text (see RequestPipeline's default id tagging).
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include "../WebSocketFactory.hpp"
+#include "../RequestPipeline.hpp"
+#include "../Histogram.hpp"
+#include "../MessageCodec.hpp"
+#include "../HandlerAllocator.hpp"
+
+// Every heap allocation in the process is counted, so the report can show what one message costs.
+// The whole replaceable set is defined so that every new is paired with a matching delete. The frees stay
+// out of line: inlined into a caller, GCC sees free() on a pointer from operator new and warns.
+static std::atomic<uint64_t> g_allocations{ 0 };
+
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+static void* CountedAlloc(std::size_t size) noexcept
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+static void* CountedAlloc(std::size_t size, std::align_val_t align) noexcept
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	auto alignment = static_cast<std::size_t>(align);
+	size = (std::max)(size, alignment);
+#ifdef _MSC_VER
+	return _aligned_malloc(size, alignment);
+#else
+	return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+BENCH_NOINLINE static void CountedFree(void* p) noexcept
+{
+	std::free(p);
+}
+
+BENCH_NOINLINE static void AlignedFree(void* p) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void* operator new(std::size_t size)
+{
+	if (void* p = CountedAlloc(size))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+	if (void* p = CountedAlloc(size, align))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+	return operator new(size, align);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size); }
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return CountedAlloc(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return CountedAlloc(size, align); }
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, std::size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, std::size_t) noexcept { CountedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { AlignedFree(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { AlignedFree(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { AlignedFree(p); }
+
+struct BenchOptions
+{
+	std::string url = "ws://127.0.0.1:8083";
+	size_t clients = 1;
+	double rate = 1000;          // messages per second, all clients together
+	size_t payload_min = 16;     // payload sizes are uniform in [payload_min, payload_max], fixed when equal
+	size_t payload_max = 16;
+	std::vector<std::pair<size_t, double>> payload_mix;   // size and weight; when set, sizes are drawn from these instead
+	double duration = 10;        // seconds measured
+	double warmup = 2;           // seconds sent but not measured
+	size_t window = 256;         // outstanding requests per connection
+	size_t shards = 0;           // 0 - one per core
+	int deadline_ms = 5000;
+	size_t reconnects = 0;       // reconnect cycles per client before the load starts
+	bool tls_resume = true;
+	int deflate = -1;            // permessage-deflate level, -1 - off
+	bool binary = false;         // binary frames carrying BenchMessage instead of "<id>|<payload>" text
+	bool echo = false;           // raw socket writes and view reads, no RequestPipeline
+	bool assert_zero_alloc = false;   // fail the run if the measured window allocated anything
+	std::string json;            // file for the JSON report, "-" for stdout
+};
+
+// Draws payload sizes as the options ask: one fixed size, uniform over a range, or a weighted mix of sizes.
+class PayloadSizes
+{
+public:
+	explicit PayloadSizes(const BenchOptions& opt)
+		: _mix(opt.payload_mix), _uniform(opt.payload_min, opt.payload_max)
+	{
+		std::vector<double> weights;
+		for (auto& entry : _mix)
+		{
+			weights.push_back(entry.second);
+		}
+		_weighted = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+	}
+
+	size_t operator()(std::mt19937& rng)
+	{
+		if (!_mix.empty())
+		{
+			return _mix[_weighted(rng)].first;
+		}
+		return _uniform.a() == _uniform.b() ? _uniform.a() : _uniform(rng);
+	}
+
+	static std::string Describe(const BenchOptions& opt)
+	{
+		std::ostringstream out;
+		if (!opt.payload_mix.empty())
+		{
+			out << "weighted";
+			const char* sep = " ";
+			for (auto& entry : opt.payload_mix)
+			{
+				out << sep << entry.first << ":" << entry.second;
+				sep = ",";
+			}
+		}
+		else if (opt.payload_min == opt.payload_max)
+		{
+			out << "fixed " << opt.payload_min;
+		}
+		else
+		{
+			out << "uniform " << opt.payload_min << "-" << opt.payload_max;
+		}
+		return out.str();
+	}
+
+protected:
+	std::vector<std::pair<size_t, double>> _mix;
+	std::discrete_distribution<size_t> _weighted;
+	std::uniform_int_distribution<size_t> _uniform;
+};
+
+// The request in --binary mode; the server echoes it back unchanged.
+struct BenchMessage
+{
+	static constexpr uint32_t Id = 1;
+	VarUInt id;
+	std::string_view payload;
+
+	template<typename Self, typename Visitor>
+	static void Visit(Self& self, Visitor& v) { v(self.id); v(self.payload); }
+};
+
+// Serialize and parse cost of one request, text tagging vs MessageCodec, measured before the load starts.
+struct CodecStats
+{
+	double text_encode_ns = 0, text_decode_ns = 0, binary_encode_ns = 0, binary_decode_ns = 0;
+	size_t text_bytes = 0, binary_bytes = 0;   // frame payload for an average request
+	// splitting a quote record on '|' and ',' and converting its numbers
+	double stream_split_ns = 0;
+	double split_ns[3] = {};                    // FieldSplitter per SimdLevel
+	SimdLevel detected = SimdLevel::Scalar;
+	size_t record_bytes = 0;
+};
+
+struct ShardStats
+{
+	Histogram latency;           // nanoseconds from intended send time to reply
+	uint64_t sent = 0, ok = 0, errors = 0, timeouts = 0, unanswered = 0;
+	uint64_t allocations = 0;    // heap allocations in the whole process while measuring
+	double cpu_seconds = 0;      // process CPU time while measuring (std::clock; wall time on Windows)
+};
+
+class BenchClient : public std::enable_shared_from_this<BenchClient>
+{
+public:
+
+	using clock = std::chrono::steady_clock;
+	// on the shard's own executor: a timer on the socket's any_io_executor allocates a copy of it on every wait
+	using Timer = net::basic_waitable_timer<clock, net::wait_traits<clock>, net::io_context::executor_type>;
+
+	BenchClient(std::shared_ptr<ISocket> sock, net::io_context& ioc, ShardStats& stats, const BenchOptions& opt, const std::string& payload, unsigned seed)
+		: _sock(sock), _timer(ioc.get_executor()), _stats(stats), _opt(opt), _payload(payload), _rng(seed), _sizes(opt)
+	{
+		_interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(opt.clients / opt.rate));
+		if (opt.echo)
+		{
+			// a slot per outstanding message: the text AsyncWrite borrows, and when it was due
+			_slots.resize(opt.window);
+			for (auto& slot : _slots)
+			{
+				slot.data.reserve(opt.payload_max);
+			}
+			return;
+		}
+		RequestPipeline::Options popt;
+		popt.window = opt.window;
+		popt.deadline = std::chrono::milliseconds(opt.deadline_ms);
+		if (opt.binary)
+		{
+			popt.tagger = [](const std::string& id, const std::string& payload) {
+				BenchMessage msg;
+				msg.id.value = std::stoull(id);
+				msg.payload = payload;
+				return MessageCodec::Encode(msg);
+			};
+			popt.key_extractor = [](const std::string& message) {
+				BenchMessage msg;
+				return MessageCodec::Decode(message, msg) ? std::to_string(msg.id.value) : std::string();
+			};
+		}
+		_pipe = std::make_shared<RequestPipeline>(sock, ioc, popt);
+	}
+
+	void Start(const std::string& port, clock::time_point begin, std::function<void(bool)> connected)
+	{
+		auto self = shared_from_this();
+		_sock->AsyncConnect(_opt.url, port, [self, begin, connected](boost::system::error_code ec) {
+			self->OnConnected(ec, self->_opt.reconnects, begin, connected);
+		});
+	}
+
+	void Close(std::function<void()> done)
+	{
+		_timer.cancel();
+		_sock->AsyncClose([done](boost::system::error_code) { done(); });
+	}
+
+private:
+
+	void OnConnected(boost::system::error_code ec, size_t reconnects, clock::time_point begin, std::function<void(bool)> connected)
+	{
+		auto self = shared_from_this();
+		if (!ec && reconnects > 0)
+		{
+			_sock->AsyncReConnect([self, reconnects, begin, connected](boost::system::error_code ec) {
+				self->OnConnected(ec, reconnects - 1, begin, connected);
+			});
+			return;
+		}
+		if (ec || !(_opt.echo ? StartEcho() : _pipe->Start()))
+		{
+			connected(false);
+			return;
+		}
+		connected(true);
+		_measure_from = begin + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(_opt.warmup));
+		_end = _measure_from + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(_opt.duration));
+		// spread the clients' send times over one interval
+		_next = begin + std::chrono::duration_cast<clock::duration>(_interval * std::uniform_real_distribution<double>(0, 1)(_rng));
+		Tick();
+	}
+
+	void Tick()
+	{
+		auto now = clock::now();
+		while (_next <= now && _next < _end)
+		{
+			Send(_next);
+			_next += _interval;
+		}
+		if (_next >= _end)
+		{
+			return;
+		}
+		auto self = shared_from_this();
+		_timer.expires_at(_next);
+		// from the client's own arena: Asio keeps one recycled block per thread, which the strand needs for itself
+		_timer.async_wait(MakeArenaHandler(_arena, [self](boost::system::error_code ec) {
+			if (!ec) self->Tick();
+		}));
+	}
+
+	void Send(clock::time_point intended)
+	{
+		bool measured = intended >= _measure_from;
+		if (measured)
+		{
+			++_stats.sent;
+		}
+		if (_opt.echo)
+		{
+			SendEcho(intended, measured);
+			return;
+		}
+		auto self = shared_from_this();
+		_pipe->Submit(_payload.substr(0, _sizes(_rng)), [self, intended, measured](boost::system::error_code ec, std::string) {
+			if (!measured) return;
+			auto& stats = self->_stats;
+			if (!ec)
+			{
+				++stats.ok;
+				stats.latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - intended).count());
+			}
+			else if (ec == net::error::timed_out)
+			{
+				++stats.timeouts;
+			}
+			else if (ec == websocket::error::closed || ec == net::error::operation_aborted)
+			{
+				++stats.unanswered;
+			}
+			else
+			{
+				++stats.errors;
+			}
+		});
+	}
+
+	// --echo: the server returns frames in the order they were sent, so each reply belongs to the oldest
+	// outstanding slot. The handlers capture only `this` (main keeps the clients alive until the loops stop),
+	// which std::function stores without allocating.
+	bool StartEcho()
+	{
+		ReadEcho();
+		return true;
+	}
+
+	void ReadEcho()
+	{
+		_sock->AsyncReadView([this](boost::system::error_code ec, MessageView view) { OnEcho(ec, std::move(view)); }, std::chrono::milliseconds(0));
+	}
+
+	void OnEcho(boost::system::error_code ec, MessageView view)
+	{
+		if (ec)
+		{
+			return;      // closed at the end of the run; what is still outstanding counts as unanswered
+		}
+		view.Release();
+		SkipFailed();
+		if (_outstanding > 0)
+		{
+			auto& slot = _slots[_head];
+			if (slot.measured)
+			{
+				++_stats.ok;
+				_stats.latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - slot.intended).count());
+			}
+			_head = (_head + 1) % _slots.size();
+			--_outstanding;
+		}
+		ReadEcho();
+	}
+
+	void SendEcho(clock::time_point intended, bool measured)
+	{
+		SkipFailed();
+		if (_outstanding == _slots.size())
+		{
+			if (measured)
+			{
+				++_stats.unanswered;   // the window is full of late replies; sending more would only queue
+			}
+			return;
+		}
+		size_t index = (_head + _outstanding++) % _slots.size();
+		auto& slot = _slots[index];
+		slot.data.assign(_payload, 0, _sizes(_rng));
+		slot.intended = intended;
+		slot.measured = measured;
+		slot.failed = false;
+		_sock->AsyncWrite(slot.data, [this, index](boost::system::error_code ec) {
+			if (!ec) return;
+			// never sent, so no reply will come for it
+			auto& slot = _slots[index];
+			slot.failed = true;
+			if (slot.measured)
+			{
+				++(ec == net::error::timed_out ? _stats.timeouts : ec == net::error::operation_aborted ? _stats.unanswered : _stats.errors);
+			}
+		}, std::chrono::milliseconds(_opt.deadline_ms));
+	}
+
+	void SkipFailed()
+	{
+		while (_outstanding > 0 && _slots[_head].failed)
+		{
+			_head = (_head + 1) % _slots.size();
+			--_outstanding;
+		}
+	}
+
+	struct EchoSlot
+	{
+		std::string data;
+		clock::time_point intended;
+		bool measured = false;
+		bool failed = false;
+	};
+
+	HandlerArena _arena;
+	std::shared_ptr<ISocket> _sock;
+	std::shared_ptr<RequestPipeline> _pipe;
+	Timer _timer;
+	ShardStats& _stats;
+	const BenchOptions& _opt;
+	const std::string& _payload;
+	std::mt19937 _rng;
+	PayloadSizes _sizes;
+	clock::duration _interval;
+	clock::time_point _next, _measure_from, _end;
+	std::vector<EchoSlot> _slots;
+	size_t _head = 0, _outstanding = 0;
+};
+
+static void Usage()
+{
+	std::cout << "exinity_bench [options]\n"
+		<< "  --url=ws://host:port/path  server (default ws://127.0.0.1:8083)\n"
+		<< "  --clients=N                connections (default 1)\n"
+		<< "  --rate=R                   messages per second over all clients, open loop (default 1000)\n"
+		<< "  --payload=N | --payload=MIN:MAX   payload size in bytes, fixed or uniform over MIN-MAX (default 16)\n"
+		<< "  --payload-mix=SIZE:WEIGHT,...     payload sizes picked with the given relative weights, e.g. 64:90,4096:9,65536:1\n"
+		<< "  --duration=S               measured seconds (default 10)\n"
+		<< "  --warmup=S                 unmeasured seconds before that (default 2)\n"
+		<< "  --window=N                 outstanding requests per connection (default 256)\n"
+		<< "  --shards=N                 event loop threads, 0 - one per core (default 0)\n"
+		<< "  --deadline-ms=N            per-request deadline (default 5000)\n"
+		<< "  --reconnects=N             reconnect every client N times before the load, to time connects\n"
+		<< "  --no-tls-resume            full TLS handshake on every connect\n"
+		<< "  --deflate[=LEVEL]          offer permessage-deflate, level 0-9 (default 6)\n"
+		<< "  --binary                   binary frames with MessageCodec-encoded requests instead of text\n"
+		<< "  --echo                     write the payload straight to the socket and read replies as views, no\n"
+		<< "                             RequestPipeline (replies matched in send order); the allocation-free path\n"
+		<< "  --assert-zero-alloc        exit with 3 if the measured window made any heap allocation\n"
+		<< "  --json=FILE                also write the report as JSON, '-' for stdout\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		std::string value;
+		auto eq = arg.find('=');
+		if (eq != std::string::npos)
+		{
+			value = arg.substr(eq + 1);
+			arg = arg.substr(0, eq);
+		}
+		else if (arg != "--help" && arg != "--no-tls-resume" && arg != "--deflate" && arg != "--binary"
+			&& arg != "--echo" && arg != "--assert-zero-alloc" && i + 1 < argc)
+		{
+			value = argv[++i];
+		}
+		try
+		{
+			if (arg == "--url") opt.url = value;
+			else if (arg == "--clients") opt.clients = std::stoul(value);
+			else if (arg == "--rate") opt.rate = std::stod(value);
+			else if (arg == "--payload")
+			{
+				auto colon = value.find(':');
+				opt.payload_min = std::stoul(value.substr(0, colon));
+				opt.payload_max = colon == std::string::npos ? opt.payload_min : std::stoul(value.substr(colon + 1));
+			}
+			else if (arg == "--payload-mix")
+			{
+				opt.payload_mix.clear();
+				std::istringstream entries(value);
+				std::string entry;
+				while (std::getline(entries, entry, ','))
+				{
+					auto colon = entry.find(':');
+					double weight = colon == std::string::npos ? 1.0 : std::stod(entry.substr(colon + 1));
+					opt.payload_mix.emplace_back(std::stoul(entry.substr(0, colon)), weight);
+				}
+			}
+			else if (arg == "--duration") opt.duration = std::stod(value);
+			else if (arg == "--warmup") opt.warmup = std::stod(value);
+			else if (arg == "--window") opt.window = std::stoul(value);
+			else if (arg == "--shards") opt.shards = std::stoul(value);
+			else if (arg == "--deadline-ms") opt.deadline_ms = std::stoi(value);
+			else if (arg == "--json") opt.json = value;
+			else if (arg == "--reconnects") opt.reconnects = std::stoul(value);
+			else if (arg == "--no-tls-resume") opt.tls_resume = false;
+			else if (arg == "--deflate") opt.deflate = value.empty() ? 6 : std::stoi(value);
+			else if (arg == "--binary") opt.binary = true;
+			else if (arg == "--echo") opt.echo = true;
+			else if (arg == "--assert-zero-alloc") opt.assert_zero_alloc = true;
+			else
+			{
+				Usage();
+				return false;
+			}
+		}
+		catch (const std::exception&)
+		{
+			std::cerr << "Bad value for " << arg << ": " << value << std::endl;
+			return false;
+		}
+	}
+	if (opt.clients == 0 || opt.rate <= 0 || opt.payload_max < opt.payload_min || opt.window == 0)
+	{
+		std::cerr << "Need clients > 0, rate > 0, window > 0 and payload MIN <= MAX" << std::endl;
+		return false;
+	}
+	if (!opt.payload_mix.empty())
+	{
+		double total = 0;
+		opt.payload_min = opt.payload_mix.front().first;
+		opt.payload_max = 0;
+		for (auto& entry : opt.payload_mix)
+		{
+			if (entry.second < 0)
+			{
+				total = -1;
+				break;
+			}
+			total += entry.second;
+			opt.payload_min = (std::min)(opt.payload_min, entry.first);
+			opt.payload_max = (std::max)(opt.payload_max, entry.first);
+		}
+		if (total <= 0)
+		{
+			std::cerr << "Need non-negative payload-mix weights with a positive sum" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Times what RequestPipeline does per request in each mode: tag on the way out, extract the id on the way in.
+static CodecStats MeasureCodec(const BenchOptions& opt, const std::string& payload)
+{
+	const size_t rounds = 200000;
+	CodecStats codec;
+	std::vector<std::string> ids, payloads;
+	std::mt19937 rng(1);
+	PayloadSizes sizes(opt);
+	for (size_t i = 0; i < 256; ++i)
+	{
+		ids.push_back(std::to_string(1000000 + i * 7919));
+		payloads.push_back(payload.substr(0, sizes(rng)));
+	}
+	std::vector<std::string> text(ids.size()), binary(ids.size());
+	size_t sink = 0;
+	auto ns_per_round = [&](auto&& body) {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; ++i)
+		{
+			body(i % ids.size());
+		}
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+	};
+
+	codec.text_encode_ns = ns_per_round([&](size_t i) { text[i] = ids[i] + "|" + payloads[i]; });
+	codec.text_decode_ns = ns_per_round([&](size_t i) { sink += text[i].substr(0, (std::min)(text[i].find('|'), text[i].length())).size(); });
+	codec.binary_encode_ns = ns_per_round([&](size_t i) {
+		BenchMessage msg;
+		msg.id.value = std::stoull(ids[i]);
+		msg.payload = payloads[i];
+		binary[i] = MessageCodec::Encode(msg);
+	});
+	codec.binary_decode_ns = ns_per_round([&](size_t i) {
+		BenchMessage msg;
+		sink += MessageCodec::Decode(binary[i], msg) ? std::to_string(msg.id.value).size() : 0;
+	});
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		codec.text_bytes += text[i].size();
+		codec.binary_bytes += binary[i].size();
+	}
+	codec.text_bytes /= ids.size();
+	codec.binary_bytes /= ids.size();
+
+	std::string record = "918273|EURUSD";
+	for (int i = 0; i < 8; ++i)
+	{
+		record += "," + std::to_string(1.08412 + i / 1e5) + "," + std::to_string(1000000 + i * 250000);
+	}
+	codec.record_bytes = record.size();
+	// the way consumers do it today: getline on a stringstream, then stream conversion
+	codec.stream_split_ns = ns_per_round([&](size_t) {
+		std::stringstream in(record);
+		std::string head, field;
+		std::getline(in, head, '|');
+		double sum = 0;
+		while (std::getline(in, field, ','))
+		{
+			std::istringstream number(field);
+			double value = 0;
+			number >> value;
+			sum += value;
+		}
+		sink += static_cast<size_t>(sum) & 1;
+	});
+	for (auto level : { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2 })
+	{
+		FieldSplitter splitter("|,", level);
+		if (splitter.Level() != level)
+		{
+			continue;
+		}
+		codec.split_ns[static_cast<int>(level)] = ns_per_round([&](size_t) {
+			double sum = 0;
+			splitter.ForEach(record, [&sum](const Field& field) {
+				double value = 0;
+				if (field.To(value)) sum += value;
+			});
+			sink += static_cast<size_t>(sum) & 1;
+		});
+	}
+	codec.detected = DetectSimd();
+	if (sink == 0)
+	{
+		std::cerr << "codec measurement optimized away" << std::endl;
+	}
+	return codec;
+}
+
+static void Report(const BenchOptions& opt, const ShardStats& total, size_t connected, const SocketStats& sockets, const CodecStats& codec, std::ostream& text)
+{
+	auto us = [&](double p) { return total.latency.Percentile(p) / 1000.0; };
+	auto phase_us = [&](ConnectPhase phase) { return sockets.Phase(phase).Mean().count() / 1000.0; };
+	auto& tls = sockets.Phase(ConnectPhase::TlsHandshake);
+	auto full_tls = tls.count - sockets.tls_resumed.count;
+	auto full_tls_us = full_tls ? (tls.total - sockets.tls_resumed.total).count() / 1000.0 / full_tls : 0.0;
+	double allocs_per_msg = total.ok ? static_cast<double>(total.allocations) / total.ok : 0.0;
+	double cpu_us_per_msg = total.ok ? total.cpu_seconds * 1e6 / total.ok : 0.0;
+	BufferPool::Counters pool;
+	if (auto buffers = WebSocketFactory::GetBufferPool())
+	{
+		pool = buffers->GetCounters();
+	}
+	text << std::fixed << std::setprecision(1)
+		<< "clients " << connected << "/" << opt.clients << ", target " << opt.rate << " msg/s, "
+		<< "payload " << PayloadSizes::Describe(opt) << " B, " << (opt.binary ? "binary" : "text")
+		<< " frames" << (opt.echo ? " (echo)" : "") << ", " << opt.duration << " s measured\n"
+		<< "sent " << total.sent << ", ok " << total.ok << ", errors " << total.errors
+		<< ", timeouts " << total.timeouts << ", unanswered " << total.unanswered << "\n"
+		<< "throughput " << total.ok / opt.duration << " msg/s\n"
+		<< "latency us: p50 " << us(50) << "  p90 " << us(90) << "  p99 " << us(99)
+		<< "  p99.9 " << us(99.9) << "  max " << total.latency.Max() / 1000.0
+		<< "  mean " << total.latency.Mean() / 1000.0 << "\n"
+		<< "heap allocations " << total.allocations << ", per message " << allocs_per_msg << "\n"
+		<< "cpu " << total.cpu_seconds << " s, us per message " << cpu_us_per_msg << "\n"
+		<< "connect us (mean): resolve " << phase_us(ConnectPhase::Resolve) << "  tcp " << phase_us(ConnectPhase::TcpConnect)
+		<< "  tls " << phase_us(ConnectPhase::TlsHandshake) << "  upgrade " << phase_us(ConnectPhase::WsUpgrade)
+		<< "  total " << sockets.connect.Mean().count() / 1000.0 << " (max " << sockets.connect.max.count() / 1000.0 << ")\n"
+		<< "tls handshakes " << tls.count << ", resumed " << sockets.tls_resumed.count
+		<< ", us (mean): full " << full_tls_us << "  resumed " << sockets.tls_resumed.Mean().count() / 1000.0 << "\n"
+		<< "socket bytes out " << sockets.bytes_sent << ", in " << sockets.bytes_received
+		<< "; wire bytes out " << sockets.wire_bytes_sent << ", in " << sockets.wire_bytes_received
+		<< " (payload/wire " << sockets.SendRatio() << " out, " << sockets.ReceiveRatio() << " in)\n"
+		<< "buffer pool hits " << pool.hits << ", misses " << pool.misses << ", oversize " << pool.oversize
+		<< ", rejected " << pool.rejected << ", high water KB: in use " << pool.in_use_high_water / 1024
+		<< "  pooled " << pool.pooled_high_water / 1024 << "\n"
+		<< "codec ns per request: text encode " << codec.text_encode_ns << "  decode " << codec.text_decode_ns
+		<< "; binary encode " << codec.binary_encode_ns << "  decode " << codec.binary_decode_ns
+		<< "; frame bytes text " << codec.text_bytes << ", binary " << codec.binary_bytes << "\n"
+		<< "split+parse ns per " << codec.record_bytes << " B record: stringstream " << codec.stream_split_ns
+		<< "  scalar " << codec.split_ns[0] << "  sse2 " << codec.split_ns[1] << "  avx2 " << codec.split_ns[2]
+		<< " (runtime pick " << SimdLevelName(codec.detected) << ", 0 - unsupported)" << std::endl;
+
+	if (opt.json.empty())
+	{
+		return;
+	}
+	std::ofstream file;
+	if (opt.json != "-")
+	{
+		file.open(opt.json);
+	}
+	std::ostream& js = opt.json == "-" ? std::cout : file;
+	js << std::fixed << std::setprecision(3)
+		<< "{\"url\":\"" << opt.url << "\",\"clients\":" << opt.clients << ",\"connected\":" << connected
+		<< ",\"target_rate\":" << opt.rate << ",\"payload\":\"" << PayloadSizes::Describe(opt) << "\",\"payload_min\":" << opt.payload_min << ",\"payload_max\":" << opt.payload_max
+		<< ",\"duration_s\":" << opt.duration << ",\"warmup_s\":" << opt.warmup
+		<< ",\"sent\":" << total.sent << ",\"ok\":" << total.ok << ",\"errors\":" << total.errors
+		<< ",\"timeouts\":" << total.timeouts << ",\"unanswered\":" << total.unanswered
+		<< ",\"throughput\":" << total.ok / opt.duration
+		<< ",\"latency_us\":{\"p50\":" << us(50) << ",\"p90\":" << us(90) << ",\"p99\":" << us(99)
+		<< ",\"p99_9\":" << us(99.9) << ",\"max\":" << total.latency.Max() / 1000.0
+		<< ",\"mean\":" << total.latency.Mean() / 1000.0 << "}"
+		<< ",\"allocations\":" << total.allocations << ",\"allocations_per_message\":" << allocs_per_msg
+		<< ",\"cpu_s\":" << total.cpu_seconds << ",\"cpu_us_per_message\":" << cpu_us_per_msg
+		<< ",\"connect_us\":{";
+	for (size_t i = 0; i < static_cast<size_t>(ConnectPhase::Count); ++i)
+	{
+		js << "\"" << ConnectPhaseName(static_cast<ConnectPhase>(i)) << "\":" << phase_us(static_cast<ConnectPhase>(i)) << ",";
+	}
+	js << "\"total\":" << sockets.connect.Mean().count() / 1000.0 << ",\"max\":" << sockets.connect.max.count() / 1000.0 << "}"
+		<< ",\"tls\":{\"handshakes\":" << tls.count << ",\"resumed\":" << sockets.tls_resumed.count
+		<< ",\"full_us\":" << full_tls_us << ",\"resumed_us\":" << sockets.tls_resumed.Mean().count() / 1000.0 << "}"
+		<< ",\"bytes_sent\":" << sockets.bytes_sent << ",\"bytes_received\":" << sockets.bytes_received
+		<< ",\"wire_bytes_sent\":" << sockets.wire_bytes_sent << ",\"wire_bytes_received\":" << sockets.wire_bytes_received
+		<< ",\"buffer_pool\":{\"hits\":" << pool.hits << ",\"misses\":" << pool.misses << ",\"oversize\":" << pool.oversize
+		<< ",\"rejected\":" << pool.rejected << ",\"in_use_high_water\":" << pool.in_use_high_water
+		<< ",\"pooled_high_water\":" << pool.pooled_high_water << "}"
+		<< ",\"echo\":" << (opt.echo ? "true" : "false")
+		<< ",\"codec\":{\"binary\":" << (opt.binary ? "true" : "false")
+		<< ",\"text_encode_ns\":" << codec.text_encode_ns << ",\"text_decode_ns\":" << codec.text_decode_ns
+		<< ",\"binary_encode_ns\":" << codec.binary_encode_ns << ",\"binary_decode_ns\":" << codec.binary_decode_ns
+		<< ",\"text_bytes\":" << codec.text_bytes << ",\"binary_bytes\":" << codec.binary_bytes << "}"
+		<< ",\"split\":{\"record_bytes\":" << codec.record_bytes << ",\"stringstream_ns\":" << codec.stream_split_ns
+		<< ",\"scalar_ns\":" << codec.split_ns[0] << ",\"sse2_ns\":" << codec.split_ns[1] << ",\"avx2_ns\":" << codec.split_ns[2]
+		<< ",\"runtime\":\"" << SimdLevelName(codec.detected) << "\"}}" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions opt;
+	if (!ParseOptions(argc, argv, opt))
+	{
+		return 2;
+	}
+
+	std::string prefix, domen, port, path;
+	std::tie(prefix, domen, port, path) = ISocket::ParseURI(opt.url);
+
+	if (!opt.tls_resume)
+	{
+		TlsOptions tls;
+		tls.resume_sessions = false;
+		WebSocketFactory::SetTlsOptions(tls);
+	}
+	if (opt.deflate >= 0)
+	{
+		CompressionOptions deflate;
+		deflate.enabled = true;
+		deflate.level = opt.deflate;
+		WebSocketFactory::SetCompression(deflate);
+	}
+
+	ShardedRuntime runtime(opt.shards);
+	std::vector<ShardStats> stats(runtime.Size());
+	runtime.Start();
+
+	std::string payload(opt.payload_max, 'x');
+	for (size_t i = 0; i < payload.size(); ++i)
+	{
+		payload[i] = static_cast<char>('a' + i % 26);
+	}
+	auto codec = MeasureCodec(opt, payload);
+
+	auto begin = BenchClient::clock::now() + std::chrono::seconds(1);
+	std::atomic<size_t> connected{ 0 }, failed{ 0 };
+	std::vector<std::shared_ptr<BenchClient>> clients;
+	for (size_t i = 0; i < opt.clients; ++i)
+	{
+		auto& shard = runtime.Shard(i);
+		auto sock = WebSocketFactory::GenerateDefault(shard, opt.url, port);
+		if (!sock)
+		{
+			return 1;
+		}
+		sock->SetBinary(opt.binary);
+		clients.push_back(std::make_shared<BenchClient>(sock, shard.Context(), stats[i % runtime.Size()], opt, payload, static_cast<unsigned>(i)));
+		clients.back()->Start(port, begin, [&](bool ok) { ++(ok ? connected : failed); });
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(1 + opt.warmup));
+	auto allocations = g_allocations.load();
+	auto cpu = std::clock();
+	std::this_thread::sleep_for(std::chrono::duration<double>(opt.duration));
+	allocations = g_allocations.load() - allocations;
+	auto cpu_seconds = static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC;
+	// give the last requests up to their deadline to come back
+	std::this_thread::sleep_for(std::chrono::milliseconds((std::min)(opt.deadline_ms, 2000)));
+
+	std::atomic<size_t> closing{ clients.size() };
+	for (auto& client : clients)
+	{
+		client->Close([&]() { --closing; });
+	}
+	for (int i = 0; i < 200 && closing > 0; ++i)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	runtime.Stop();
+
+	ShardStats total;
+	for (auto& shard : stats)
+	{
+		total.latency.Merge(shard.latency);
+		total.sent += shard.sent;
+		total.ok += shard.ok;
+		total.errors += shard.errors;
+		total.timeouts += shard.timeouts;
+		total.unanswered += shard.unanswered;
+	}
+	total.allocations = allocations;
+	total.cpu_seconds = cpu_seconds;
+	total.unanswered += total.sent - (std::min)(total.sent, total.ok + total.errors + total.timeouts + total.unanswered);
+	if (failed > 0)
+	{
+		std::cerr << failed << " clients failed to connect" << std::endl;
+	}
+	Report(opt, total, connected, WebSocketFactory::AggregateStats(), codec, std::cout);
+	if (connected != opt.clients)
+	{
+		return 1;
+	}
+	if (opt.assert_zero_alloc && (total.allocations > 0 || total.ok == 0))
+	{
+		std::cerr << "expected no heap allocations per message, got " << total.allocations << " over " << total.ok << " messages" << std::endl;
+		return 3;
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Hermetic benchmark run: starts exinity_server on localhost and runs exinity_bench against it, over ws and then wss.
+# Usage: bench/run_local.sh <build dir> [exinity_bench options]; SERVER_OPTS is passed to exinity_server.
+BUILD=${1:-build}
+[ $# -gt 0 ] && shift
+PORT=${PORT:-18083}
+
+run() {
+	scheme=$1
+	shift
+	if [ "$scheme" = wss ]; then tls=--wss; else tls=; fi
+	"$BUILD/exinity_server" --port=$PORT $tls $SERVER_OPTS &
+	server=$!
+	sleep 1
+	"$BUILD/exinity_bench" --url=$scheme://127.0.0.1:$PORT "$@"
+	status=$?
+	kill $server
+	wait $server 2>/dev/null
+	return $status
+}
+
+run ws "$@" && run wss "$@"
@@ -1,46 +1,73 @@
 #include <iostream>
 #include "WebSocketFactory.hpp"
-#include "Logger/BasicLogger.hpp"
+#include "Logger/AsyncLogger.hpp"
+#include "ReconnectSupervisor.hpp"
 #include <filesystem>
 #include "Utils.hpp"
 
-void for_tests() {
+// one test client: write a random number, print the reply, wait, repeat - all on the socket's shard
+class TestClient : public std::enable_shared_from_this<TestClient>
+{
+public:
 
-	int n = 1; // amount of clients
-	int message_every_n_sec = 10; // each clients sends message every n seconds
+	TestClient(std::shared_ptr<ISocket> sock, std::chrono::seconds period)
+		: _sock(sock), _timer(sock->GetExecutor()), _period(period) {}
 
-	for (int i = 0; i < n; ++i)
+	void Start(const std::string& host, const std::string& port)
 	{
+		auto self = shared_from_this();
+		_sock->AsyncConnect(host, port, [self](boost::system::error_code ec) {
+			if (!ec) self->Send();
+		});
+	}
 
-		std::thread th([&message_every_n_sec,&i]() {
+private:
 
-		std::shared_ptr<BasicLogger> logger = std::make_shared<BasicLogger>();
-		logger->AssignFiles("sock_client_"+std::to_string(i) + ".log");
-		WebSocketFactory::SetDefaultLogger(logger);
+	void Send()
+	{
+		auto self = shared_from_this();
+		_msg = std::to_string(intRand(0, 1023));
+		//_msg = "abc|test";
+		_sock->AsyncWrite(_msg, [self](boost::system::error_code ec) {
+			if (ec) return;
+			self->_sock->AsyncRead([self](boost::system::error_code ec, std::string resp) {
+				if (ec) return;
+				std::cout << resp << std::endl;
+				self->_timer.expires_after(self->_period);
+				self->_timer.async_wait([self](boost::system::error_code ec) {
+					if (!ec) self->Send();
+				});
+			});
+		});
+	}
 
-		net::io_context ioc;
+	std::shared_ptr<ISocket> _sock;
+	net::steady_timer _timer;
+	std::chrono::seconds _period;
+	std::string _msg;
+};
 
-		auto host = "ws://127.0.0.1";
-		auto port = "8083";
-		auto sock = WebSocketFactory::GenerateDefault(ioc, host, port);
+void for_tests() {
 
-		sock->Connect(host, port);
+	int n = 1; // amount of clients
+	int message_every_n_sec = 10; // each clients sends message every n seconds
 
-		for (;;)
-		{
-			int val = intRand(0, 1023);
-			sock->Write(std::to_string(val));
-			//sock->Write("abc|test");
-			if (!sock->IsOpen()) break;
-			std::string resp;
-			auto bstatus = sock->Read(resp);
-			std::cout << resp << std::endl;
-
-			std::this_thread::sleep_for(std::chrono::seconds(message_every_n_sec));
-		}
+	std::shared_ptr<AsyncLogger> logger = std::make_shared<AsyncLogger>();
+	logger->AssignFiles("sock_client.log");
+	WebSocketFactory::SetDefaultLogger(logger);
 
-		});
-	th.detach();
+	ShardedRuntime runtime; // one io_context per core drives all clients
+	runtime.Start();
+
+	auto host = "ws://127.0.0.1";
+	auto port = "8083";
+
+	std::vector<std::shared_ptr<TestClient>> clients;
+	for (int i = 0; i < n; ++i)
+	{
+		auto sock = WebSocketFactory::GenerateDefault(runtime, host, port);
+		clients.push_back(std::make_shared<TestClient>(sock, std::chrono::seconds(message_every_n_sec)));
+		clients.back()->Start(host, port);
 	}
 
 	while (true)
@@ -49,67 +76,84 @@ void for_tests() {
 	}
 }
 
-void production() {
+void production(bool standby) {
 	Logger::initializeLog();
-	std::shared_ptr<BasicLogger> logger = std::make_shared<BasicLogger>();
+	std::shared_ptr<AsyncLogger> logger = std::make_shared<AsyncLogger>();
 	logger->AssignFiles("sock_client.log");
 	WebSocketFactory::SetDefaultLogger(logger);
 
 	auto host = "ws://127.0.0.1";
 	auto port = "8083";
 
-	bool closed = false;
-	int attempt = 0;
-	while (!closed)
-	{
-		std::string picked_exchange;
-		net::io_context ioc;
-		auto sock = WebSocketFactory::GenerateDefault(ioc, host, port);
-		sock->Connect(host, port);
+	EventLoop loop(1);
+	loop.Start();
+
+	// requests still waiting for their response, oldest first
+	std::mutex pending_mutex;
+	std::deque<std::string> pending;
 
-		if (!sock->IsOpen())
+	ReconnectSupervisor::Options opt;
+	opt.standby = standby;
+	opt.heartbeat = true;
+	auto supervisor = std::make_shared<ReconnectSupervisor>(loop.Context(),
+		[&loop, host, port]() { return WebSocketFactory::GenerateDefault(loop, host, port); }, host, port, opt);
+	supervisor->OnMessage([&](boost::system::error_code, std::string resp) {
+		std::string request;
 		{
-			std::this_thread::sleep_for(std::chrono::seconds(10));
-			std::cout << "\r                                                     ";
-			std::cout << "\rReconnection ";
-			sock->Close();
-			int p = attempt % 5 + 1;
-			for (auto k = 0; k < p; ++k) std::cout << ".";
-			++attempt;
+			std::lock_guard<std::mutex> lock(pending_mutex);
+			if (!pending.empty()) {
+				request = std::move(pending.front());
+				pending.pop_front();
+			}
+		}
+		Logger::log({ request, resp });
+		std::cout << "response: " << resp << std::endl;
+	});
+	supervisor->OnStateChange([&](bool up) {
+		if (up) {
+			std::cout << "Connected" << std::endl;
+			return;
+		}
+		std::cout << "Connection lost, reconnecting" << std::endl;
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending.clear();
+	});
+	supervisor->Start();
+
+	std::string getres;
+	while (getline(std::cin, getres))
+	{
+		if (getres == std::string("close")) {
+			supervisor->Send(getres);
+			break;
+		}
+		if (!supervisor->IsUp()) {
+			std::cout << "Not connected, request dropped" << std::endl;
 			continue;
 		}
-
-		for (;;)
 		{
-			std::string getres;
-			getline(std::cin, getres);
-
-			sock->Write(getres);
-
-			if (getres == std::string("close")) {
-				closed = true;
-				sock->Close();
-				break;
-			}
-			if (!sock->IsOpen()) break;
-			std::string resp;
-			auto status = sock->Read(resp);
-			if (!status) break;
-			Logger::log({ getres, resp });
-			std::cout << "response: " << resp << std::endl;// //
+			std::lock_guard<std::mutex> lock(pending_mutex);
+			pending.push_back(getres);
 		}
+		supervisor->Send(getres);
 	}
+
+	std::promise<void> closed;
+	supervisor->Stop([&closed]() { closed.set_value(); });
+	closed.get_future().wait_for(std::chrono::seconds(5));
+	loop.Stop();
+	Logger::flush();
 }
 
-void main(int argc, char* argv[])
+// exinity_client [--test | --standby]
+// --test runs the for_tests() clients; exinity_bench is the load/latency benchmark
+// --standby keeps a second connection open for failover (twice the connections on the server)
+int main(int argc, char* argv[])
 {
-#define testing false
+	if (argc > 1 && std::string(argv[1]) == "--test")
+		for_tests();
+	else
+		production(argc > 1 && std::string(argv[1]) == "--standby");
 
-#if typeTest == true
-	for_tests();
-#else
-	production();
-#endif
-
-	return;
-}
\ No newline at end of file
+	return 0;
+}
@@ -0,0 +1,363 @@
+// Local stand-in WebSocket server for hermetic runs of the client and exinity_bench.
+// Modes: echo (reply with the request) or canned (reply with configured texts in turn, keeping the
+// request's "<id>|" prefix so RequestPipeline can match the replies). Optional think time before each
+// reply, optional server-push stream per connection, optional wss with a generated self-signed cert.
+#include <utility>              // before Asio: Boost 1.74's awaitable.hpp uses std::exchange without including it
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/ec.h>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+namespace net = boost::asio;
+namespace ssl = net::ssl;
+using tcp = net::ip::tcp;
+
+struct ServerOptions
+{
+	std::string address = "127.0.0.1";
+	unsigned short port = 8083;
+	size_t threads = 1;
+	bool canned = false;
+	std::vector<std::string> replies;     // canned mode
+	int think_ms = 0;                     // delay before every reply
+	double push_rate = 0;                 // pushed messages per second per connection, 0 - off
+	size_t push_size = 64;
+	bool wss = false;
+	std::string cert, key;                // PEM files; a self-signed pair is generated when empty
+	bool deflate = false;
+};
+
+// Writes go through a queue so replies and pushed messages never overlap on the stream.
+template<typename Stream>
+class Session : public std::enable_shared_from_this<Session<Stream>>
+{
+public:
+
+	Session(Stream stream, const ServerOptions& opt)
+		: _ws(std::move(stream)), _opt(opt), _push_timer(_ws.get_executor()) {}
+
+	void Run()
+	{
+		if (_opt.deflate)
+		{
+			websocket::permessage_deflate pmd;
+			pmd.server_enable = true;
+			_ws.set_option(pmd);
+		}
+		_ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::server));
+		_ws.read_message_max(1ull << 26);
+		_ws.async_accept(beast::bind_front_handler(&Session::OnAccept, this->shared_from_this()));
+	}
+
+private:
+
+	void OnAccept(beast::error_code ec)
+	{
+		if (ec) return;
+		if (_opt.push_rate > 0)
+		{
+			_push_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / _opt.push_rate));
+			_next_push = std::chrono::steady_clock::now() + _push_interval;
+			Push();
+		}
+		Read();
+	}
+
+	void Read()
+	{
+		_ws.async_read(_buffer, beast::bind_front_handler(&Session::OnRead, this->shared_from_this()));
+	}
+
+	void OnRead(beast::error_code ec, size_t)
+	{
+		if (ec)
+		{
+			_push_timer.cancel();
+			return;
+		}
+		bool text = _ws.got_text();
+		auto reply = MakeReply(beast::buffers_to_string(_buffer.data()));
+		_buffer.consume(_buffer.size());
+		if (_opt.think_ms > 0)
+		{
+			auto timer = std::make_shared<net::steady_timer>(_ws.get_executor(), std::chrono::milliseconds(_opt.think_ms));
+			auto self = this->shared_from_this();
+			timer->async_wait([self, timer, text, reply = std::move(reply)](beast::error_code ec) mutable {
+				if (!ec) self->Send(std::move(reply), text);
+			});
+		}
+		else
+		{
+			Send(std::move(reply), text);
+		}
+		Read();
+	}
+
+	std::string MakeReply(std::string request)
+	{
+		if (!_opt.canned || _opt.replies.empty())
+		{
+			return request;
+		}
+		auto& canned = _opt.replies[_next_reply++ % _opt.replies.size()];
+		auto bar = request.find('|');
+		return bar == std::string::npos ? canned : request.substr(0, bar + 1) + canned;
+	}
+
+	void Push()
+	{
+		_push_timer.expires_at(_next_push);
+		_push_timer.async_wait([self = this->shared_from_this()](beast::error_code ec) {
+			if (ec) return;
+			auto now = std::chrono::steady_clock::now();
+			// open loop: catch up if the timer was late, but don't build an unbounded backlog
+			for (int burst = 0; self->_next_push <= now && burst < 1000; ++burst)
+			{
+				auto msg = "push|" + std::to_string(self->_pushed++) + "|";
+				msg.resize((std::max)(msg.size(), self->_opt.push_size), 'p');
+				self->Send(std::move(msg), true);
+				self->_next_push += self->_push_interval;
+			}
+			if (self->_next_push <= now)
+			{
+				self->_next_push = now + self->_push_interval;
+			}
+			self->Push();
+		});
+	}
+
+	void Send(std::string msg, bool text)
+	{
+		_queue.emplace_back(std::move(msg), text);
+		if (_queue.size() == 1)
+		{
+			Write();
+		}
+	}
+
+	void Write()
+	{
+		_ws.text(_queue.front().second);
+		_ws.async_write(net::buffer(_queue.front().first), beast::bind_front_handler(&Session::OnWrite, this->shared_from_this()));
+	}
+
+	void OnWrite(beast::error_code ec, size_t)
+	{
+		if (ec) return;
+		_queue.pop_front();
+		if (!_queue.empty())
+		{
+			Write();
+		}
+	}
+
+	websocket::stream<Stream> _ws;
+	const ServerOptions& _opt;
+	beast::flat_buffer _buffer;
+	std::deque<std::pair<std::string, bool>> _queue;
+	size_t _next_reply = 0;
+	net::steady_timer _push_timer;
+	std::chrono::steady_clock::duration _push_interval{};
+	std::chrono::steady_clock::time_point _next_push;
+	uint64_t _pushed = 0;
+};
+
+class Listener : public std::enable_shared_from_this<Listener>
+{
+public:
+
+	Listener(net::io_context& ioc, ssl::context& ctx, const ServerOptions& opt)
+		: _ioc(ioc), _ctx(ctx), _opt(opt), _acceptor(net::make_strand(ioc))
+	{
+		tcp::endpoint endpoint(net::ip::make_address(opt.address), opt.port);
+		_acceptor.open(endpoint.protocol());
+		_acceptor.set_option(net::socket_base::reuse_address(true));
+		_acceptor.bind(endpoint);
+		_acceptor.listen(net::socket_base::max_listen_connections);
+	}
+
+	void Accept()
+	{
+		_acceptor.async_accept(net::make_strand(_ioc), beast::bind_front_handler(&Listener::OnAccept, shared_from_this()));
+	}
+
+private:
+
+	void OnAccept(beast::error_code ec, tcp::socket socket)
+	{
+		if (!ec)
+		{
+			socket.set_option(tcp::no_delay(true));
+			if (_opt.wss)
+			{
+				auto stream = std::make_shared<beast::ssl_stream<beast::tcp_stream>>(beast::tcp_stream(std::move(socket)), _ctx);
+				stream->async_handshake(ssl::stream_base::server, [stream, &opt = _opt](beast::error_code ec) {
+					if (!ec) std::make_shared<Session<beast::ssl_stream<beast::tcp_stream>>>(std::move(*stream), opt)->Run();
+				});
+			}
+			else
+			{
+				std::make_shared<Session<beast::tcp_stream>>(beast::tcp_stream(std::move(socket)), _opt)->Run();
+			}
+		}
+		Accept();
+	}
+
+	net::io_context& _ioc;
+	ssl::context& _ctx;
+	const ServerOptions& _opt;
+	tcp::acceptor _acceptor;
+};
+
+// P-256 key and a self-signed CN=localhost certificate valid for a year.
+static bool UseSelfSigned(ssl::context& ctx)
+{
+	EVP_PKEY* pkey = nullptr;
+	EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+	bool ok = kctx && EVP_PKEY_keygen_init(kctx) > 0
+		&& EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) > 0
+		&& EVP_PKEY_keygen(kctx, &pkey) > 0;
+	EVP_PKEY_CTX_free(kctx);
+	if (!ok) return false;
+
+	X509* cert = X509_new();
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 365L * 24 * 3600);
+	X509_set_pubkey(cert, pkey);
+	X509_NAME* name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	ok = X509_sign(cert, pkey, EVP_sha256()) > 0
+		&& SSL_CTX_use_certificate(ctx.native_handle(), cert) == 1
+		&& SSL_CTX_use_PrivateKey(ctx.native_handle(), pkey) == 1;
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+	return ok;
+}
+
+static void Usage()
+{
+	std::cout << "exinity_server [options]\n"
+		<< "  --address=A --port=P     listen endpoint (default 127.0.0.1:8083)\n"
+		<< "  --threads=N              io threads (default 1)\n"
+		<< "  --reply=TEXT             canned mode, may be repeated; replies are used in turn\n"
+		<< "  --replies=FILE           canned mode, one reply per line\n"
+		<< "  --think-ms=N             delay before each reply\n"
+		<< "  --push-rate=R            push R messages/s to every connection\n"
+		<< "  --push-size=N            size of pushed messages (default 64)\n"
+		<< "  --wss                    TLS; self-signed unless --cert/--key (PEM) are given\n"
+		<< "  --deflate                offer permessage-deflate\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], ServerOptions& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i], value;
+		auto eq = arg.find('=');
+		if (eq != std::string::npos)
+		{
+			value = arg.substr(eq + 1);
+			arg = arg.substr(0, eq);
+		}
+		else if (arg != "--wss" && arg != "--deflate" && arg != "--help" && i + 1 < argc)
+		{
+			value = argv[++i];
+		}
+		try
+		{
+			if (arg == "--address") opt.address = value;
+			else if (arg == "--port") opt.port = static_cast<unsigned short>(std::stoul(value));
+			else if (arg == "--threads") opt.threads = (std::max)(std::stoul(value), 1ul);
+			else if (arg == "--reply") { opt.canned = true; opt.replies.push_back(value); }
+			else if (arg == "--replies")
+			{
+				std::ifstream file(value);
+				if (!file) { std::cerr << "Can't open " << value << std::endl; return false; }
+				for (std::string line; std::getline(file, line);) opt.replies.push_back(line);
+				opt.canned = true;
+			}
+			else if (arg == "--think-ms") opt.think_ms = std::stoi(value);
+			else if (arg == "--push-rate") opt.push_rate = std::stod(value);
+			else if (arg == "--push-size") opt.push_size = std::stoul(value);
+			else if (arg == "--wss") opt.wss = true;
+			else if (arg == "--cert") opt.cert = value;
+			else if (arg == "--key") opt.key = value;
+			else if (arg == "--deflate") opt.deflate = true;
+			else { Usage(); return false; }
+		}
+		catch (const std::exception&)
+		{
+			std::cerr << "Bad value for " << arg << ": " << value << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	ServerOptions opt;
+	if (!ParseOptions(argc, argv, opt))
+	{
+		return 2;
+	}
+
+	ssl::context ctx(ssl::context::tls_server);
+	if (opt.wss)
+	{
+		bool ok = opt.cert.empty()
+			? UseSelfSigned(ctx)
+			: SSL_CTX_use_certificate_chain_file(ctx.native_handle(), opt.cert.c_str()) == 1
+			&& SSL_CTX_use_PrivateKey_file(ctx.native_handle(), opt.key.c_str(), SSL_FILETYPE_PEM) == 1;
+		if (!ok)
+		{
+			std::cerr << "Can't set up the TLS certificate" << std::endl;
+			return 1;
+		}
+	}
+
+	net::io_context ioc(static_cast<int>(opt.threads));
+	try
+	{
+		std::make_shared<Listener>(ioc, ctx, opt)->Accept();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Can't listen on " << opt.address << ":" << opt.port << ": " << e.what() << std::endl;
+		return 1;
+	}
+	std::cout << "Listening on " << (opt.wss ? "wss://" : "ws://") << opt.address << ":" << opt.port
+		<< (opt.canned ? " (canned)" : " (echo)") << std::endl;
+
+	net::signal_set signals(ioc, SIGINT, SIGTERM);
+	signals.async_wait([&](beast::error_code, int) { ioc.stop(); });
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < opt.threads; ++i)
+	{
+		threads.emplace_back([&ioc]() { ioc.run(); });
+	}
+	ioc.run();
+	for (auto& th : threads)
+	{
+		th.join();
+	}
+	return 0;
+}